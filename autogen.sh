@@ -4,8 +4,8 @@
 
 COMMON_CPPFLAGS="-I/usr/local/include"
 COMMON_CFLAGS="-Wall"
-COMMON_CXXFLAGS="${COMMON_CFLAGS} -std=c++14"
-COMMON_LDFLAGS="-L/usr/local/lib"
+COMMON_CXXFLAGS="${COMMON_CFLAGS} -std=c++14 -pthread"
+COMMON_LDFLAGS="-L/usr/local/lib -pthread"
 COMMON_LDADD=""
 
 OUT=Makefile.am
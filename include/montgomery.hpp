@@ -2,90 +2,275 @@
 #define PQC_MONTGOMERY_HPP
 
 #include <iostream>
+#include <memory>
+#include <vector>
 
 #include <pqc_gf.hpp>
+#include <pqc_fp751.hpp>
+#include <pqc_weierstrass.hpp>
 
 namespace pqc {
 
-class MontgomeryPoint;
+/* x-only arithmetic on Montgomery curves
+     B·y² = x³ + A·x² + x
+   Points are kept projectively as (X : Z) with x = X/Z, the identity being
+   (1 : 0).  The y coordinate is never computed, so a point and its
+   negative are the same here and addition is only possible if the
+   difference of the summands is known.  That is enough for the Montgomery
+   ladder and for isogeny computations, and needs neither inversions nor
+   square roots.
 
+   Like the Weierstrass classes these are templates over the field, GF and
+   GF751 are explicitly instantiated in montgomery.cpp.  */
+
+template<typename F> class MontgomeryCurve;
+template<typename F> class MontgomeryPoint;
+template<typename F> class MontgomeryIsogeny;
+
+template<typename F> using MontgomeryCurvePtr = std::shared_ptr<MontgomeryCurve<F>>;
+template<typename F> using MontgomeryCurveConstPtr = std::shared_ptr<const MontgomeryCurve<F>>;
+template<typename F> using MontgomeryCurveHandle = CurveHandle<MontgomeryCurve<F>>;
+
+template<typename F>
 class MontgomeryCurve {
-	GF A, B, A24;
+	F A, B, A24;
 public:
-	MontgomeryCurve(const GF& _A, const GF& _B) : A(_A), B(_B), A24(A) {
+	friend class MontgomeryPoint<F>;
+	friend class MontgomeryIsogeny<F>;
+
+	MontgomeryCurve(const F& _A, const F& _B) : A(_A), B(_B), A24(A) {
 		A24 += 2;
 		A24 /= 4;
 	}
 
-	MontgomeryPoint zero();
+	const F& get_A() const {
+		return A;
+	}
+
+	const F& get_B() const {
+		return B;
+	}
+
+	MontgomeryPoint<F> zero() const;
+
+	/* j = 256·(A² - 3)³ / (A² - 4) */
+	F j_invariant() const {
+		F AA = A.square();
+		F t = AA - 3;
+		return 256 * t.square() * t / (AA - 4);
+	}
+
+	/* The short Weierstrass model
+	     y'² = x'³ + a·x' + b,  a = (3 - A²)/(3B²),  b = (2A³ - 9A)/(27B³)
+	   with x' = (x + A/3)/B and y' = y/B.  */
+	WeierstrassCurvePtr<F> to_weierstrass() const;
+
+	/* The inverse of to_weierstrass for a Weierstrass curve given by its
+	   point T = (α, 0) of order two.  Substituting x' = λ·x + α with
+	   λ² = 3α² + a gives
+	     λ⁻¹·y² = x³ + (3α/λ)·x² + x,
+	   whose Weierstrass model is the curve of T again.  Returns a null
+	   pointer if T is not of order two or 3α² + a is not a square.  */
+	static MontgomeryCurvePtr<F> from_weierstrass(const WeierstrassPoint<F>& T);
 
 	friend std::ostream& operator<<(std::ostream& os, const MontgomeryCurve& curve) {
 		os << curve.B << " y² = x³ + " << curve.A << "·x² + x";
 		return os;
 	}
-
-	friend class MontgomeryPoint;
 };
 
+template<typename F>
 class MontgomeryPoint {
-	const MontgomeryCurve& curve;
-	GF X, Z;
-	static GF t1, t2, t3;
+	MontgomeryCurveHandle<F> m_curve;
+	F X, Z;
+	static thread_local F t1, t2, t3;
 public:
-	MontgomeryPoint(const MontgomeryCurve& _curve, const GF& _X, const GF& _Z) :
-		curve(_curve), X(_X), Z(_Z) {}
+	friend class MontgomeryCurve<F>;
+	friend class MontgomeryIsogeny<F>;
 
-private:
-	/* http://wstein.org/edu/124/misc/montgomery.pdf strana 261
-	   also from wikipedia https://en.wikipedia.org/wiki/Montgomery_curve
-	   */
-	MontgomeryPoint& do_diff_add(const MontgomeryPoint& other, const MontgomeryPoint& diff) {
-		t1 = (X + Z)*(other.X - other.Z);
-		t2 = (X - Z)*(other.X + other.Z);
-		X = diff.Z * (t1 + t2).square_inplace();
-		Z = diff.X * (t1 - t2).square_inplace();
-		return *this;
+	MontgomeryPoint() {}
+
+	MontgomeryPoint(MontgomeryCurveHandle<F> curve, const F& _X, const F& _Z) :
+		m_curve(curve), X(_X), Z(_Z) {}
+
+	/* The image of a point on curve->to_weierstrass(), x = B·x' - A/3 */
+	MontgomeryPoint(MontgomeryCurveHandle<F> curve, const WeierstrassPoint<F>& P);
+
+	MontgomeryCurveHandle<F> curve() const {
+		return m_curve;
+	}
+
+	bool is_identity() const {
+		return !Z;
+	}
+
+	/* The affine x coordinate, zero for the identity */
+	F x() const {
+		if (is_identity())
+			return F(X.get_p());
+		return X / Z;
 	}
 
-	MontgomeryPoint& do_double() {
-		t1 = (X + Z).square_inplace();
-		t2 = (X - Z).square_inplace();
+	/* One of the two points of curve()->to_weierstrass() which map to this
+	   point, or a point without curve if it lies on the quadratic twist.  */
+	WeierstrassPoint<F> to_weierstrass(WeierstrassCurveHandle<F>) const;
+
+	bool operator==(const MontgomeryPoint& other) const {
+		if (is_identity() || other.is_identity())
+			return is_identity() == other.is_identity();
+		return X * other.Z == other.X * Z;
+	}
+
+	bool operator!=(const MontgomeryPoint& other) const {
+		return !(*this == other);
+	}
+
+	/* xDBL, 2·(X : Z) with A24 = (A + 2)/4:
+	     X₂ = (X + Z)²·(X - Z)²
+	     Z₂ = 4XZ·((X - Z)² + A24·4XZ),  where 4XZ = (X + Z)² - (X - Z)²
+	   http://wstein.org/edu/124/misc/montgomery.pdf page 261, also
+	   https://en.wikipedia.org/wiki/Montgomery_curve  */
+	MontgomeryPoint& double_inplace() {
+		t1 = (X + Z).square();
+		t2 = (X - Z).square();
 		t3 = t1 - t2;
 		X = t1 * t2;
-		Z = t3 * (t2 + curve.A24 * t3);
+		Z = t3 * (t2 + m_curve->A24 * t3);
 		return *this;
 	}
 
-public:
-	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
-	MontgomeryPoint& operator*=(const T& n) {
-		MontgomeryPoint t1, t2;
-
-		if (!Z)
-			return *this;
-
-		if (!n) {
-			Z = 0;
-		} else if (n == 2) {
-			do_double();
-		} else if (n == 3) {
-			t1 = *this;          // t1 = P
-			do_double();         // this = 2P
-			do_diff_add(t1, t1); // this = this+t1 = 2P+P = 3P
-		} else if (n == 5) {
-			t1 = *this;          // t1 = P
-			do_double();         // this = 2P
-			t2 = *this;          // t2 = 2P
-			do_diff_add(t1, t1); // this = this + t1 = 2P+P = 3P
-			do_diff_add(t2, t1); // this = this + t2 = 3P+2P = 5P
-		} else {
-			// mont_3ladder, pretoze chceme pocitat P + m¯¹nQ
-			// takze cely tento kod pojde dopice
-		}
+	/* xADD, this + other given diff = this - other (or other - this):
+	     X₊ = Z₋·((X - Z)·(X' + Z') + (X + Z)·(X' - Z'))²
+	     Z₊ = X₋·((X - Z)·(X' + Z') - (X + Z)·(X' - Z'))²
+	   The difference must not be the identity nor (0 : 1).  */
+	MontgomeryPoint& diff_add(const MontgomeryPoint& other, const MontgomeryPoint& diff) {
+		t1 = (X + Z) * (other.X - other.Z);
+		t2 = (X - Z) * (other.X + other.Z);
+		X = diff.Z * (t1 + t2).square();
+		Z = diff.X * (t1 - t2).square();
 		return *this;
 	}
+
+	/* xDBLADD, P ← 2P and Q ← P + Q for diff = P - Q, which share the sum
+	   and the difference of the coordinates of P.  This is one step of the
+	   ladder.  */
+	static void double_add(MontgomeryPoint& P, MontgomeryPoint& Q, const MontgomeryPoint& diff);
+
+	/* xTPL, 3P = 2P + P */
+	MontgomeryPoint& triple_inplace() {
+		MontgomeryPoint P(*this);
+		double_inplace();
+		return diff_add(P, P);
+	}
+
+	/* x(P + k·Q) for k ≥ 0 from x(P), x(Q) and x(P - Q), going through the
+	   bits of k from the lowest with
+	     R₀ = 2ⁱ·Q,  R₁ = P + (k mod 2ⁱ)·Q,  R₂ = R₁ - R₀,
+	   where a set bit adds R₀ to R₁, whose difference is R₂, and a clear
+	   one subtracts R₀ from R₂, whose sum is R₁.  That is one double_add
+	   per bit, the cost of a single ladder instead of two of them and an
+	   addition.  P + j·Q must not be the identity nor (0 : 1) for any j,
+	   which holds for independent P and Q.  */
+	static MontgomeryPoint three_point_ladder(const MontgomeryPoint& P, const MontgomeryPoint& Q,
+						  const MontgomeryPoint& PmQ, const pqc::Z& k);
+
+	/* The Montgomery ladder, which keeps R₁ - R₀ = P and so does one
+	   double_add per bit of the scalar.  */
+	MontgomeryPoint& operator*=(const pqc::Z& n);
+
+	MontgomeryPoint operator*(const pqc::Z& n) const {
+		MontgomeryPoint res(*this);
+		res *= n;
+		return res;
+	}
+
+	friend MontgomeryPoint operator*(const pqc::Z& n, const MontgomeryPoint& P) {
+		return P * n;
+	}
+
+	friend std::ostream& operator<<(std::ostream& os, const MontgomeryPoint& point) {
+		if (point.is_identity())
+			os << "identity ∈ " << *point.m_curve;
+		else
+			os << "(" << point.x() << ") ∈ " << *point.m_curve;
+		return os;
+	}
+};
+
+/* An isogeny of degree base^exp, base 2 or 3, computed as a chain of
+   4-isogenies (preceded by one 2-isogeny if exp is odd) or of 3-isogenies.
+   The intermediate curves are kept projectively as (A : C) with the
+   coefficient A/C, in the forms (A + 2C : 4C) and (A + 2C : A - 2C) the
+   doubling and tripling formulas want, so that neither the walk nor the
+   evaluation of points needs an inversion.  The formulas are those of
+     Costello, Longa, Naehrig: Efficient algorithms for supersingular
+     isogeny Diffie-Hellman, CRYPTO 2016.
+
+   The 4-isogeny formulas do not cover kernels containing (0, 0), so for
+   base 2 the model of the domain has to be chosen such that
+   2^(exp-1)·generator is one of the other points of order two.
+
+   Unlike WeierstrassIsogeny the steps are not kept, the points to be
+   mapped are given to the constructor and evaluated along the way.
+   Afterwards they lie on image(), whose B is chosen so that they are
+   points of the curve and not of its quadratic twist.  */
+template<typename F>
+class MontgomeryIsogeny {
+	int m_base, m_exp;
+	F m_A, m_C;
+	MontgomeryCurvePtr<F> m_image;
+public:
+	MontgomeryIsogeny(const MontgomeryPoint<F>& generator, int base, int exp, const std::vector<int>& strategy,
+			  MontgomeryPoint<F> *first = nullptr, MontgomeryPoint<F> *last = nullptr);
+
+	Z degree() const {
+		return Z(m_base).pow(m_exp);
+	}
+
+	/* The coefficient of the image as the pair (A : C) */
+	const F& get_A() const {
+		return m_A;
+	}
+
+	const F& get_C() const {
+		return m_C;
+	}
+
+	const MontgomeryCurvePtr<F>& image() const {
+		return m_image;
+	}
+
+	/* j = 256·(A² - 3C²)³ / (C⁴·(A² - 4C²)) */
+	F j_invariant() const;
+
+private:
+	/* The kernel points are multiplied by the constants (A + 2C : 4C) for
+	   base 2 and (A + 2C : A - 2C) for base 3 */
+	static void xDBL(MontgomeryPoint<F>&, const F& A24plus, const F& C24);
+	static void xTPL(MontgomeryPoint<F>&, const F& A24plus, const F& A24minus);
+
+	/* 2^e·P and 3^e·P, the multiplications of the strategy traversal */
+	static void xDBLe(MontgomeryPoint<F>&, const F& A24plus, const F& C24, int e);
+	static void xTPLe(MontgomeryPoint<F>&, const F& A24plus, const F& A24minus, int e);
+
+	/* The image constants from a kernel point and the coefficients needed
+	   to evaluate the isogeny */
+	static void get_2_isog(const MontgomeryPoint<F>&, F& A24plus, F& C24);
+	static void eval_2_isog(const MontgomeryPoint<F>&, MontgomeryPoint<F>&);
+	static void get_4_isog(const MontgomeryPoint<F>&, F& A24plus, F& C24, F *coeff);
+	static void eval_4_isog(const F *coeff, MontgomeryPoint<F>&);
+	static void get_3_isog(const MontgomeryPoint<F>&, F& A24plus, F& A24minus, F *coeff);
+	static void eval_3_isog(const F *coeff, MontgomeryPoint<F>&);
 };
 
+extern template class MontgomeryCurve<GF>;
+extern template class MontgomeryPoint<GF>;
+extern template class MontgomeryIsogeny<GF>;
+
+extern template class MontgomeryCurve<GF751>;
+extern template class MontgomeryPoint<GF751>;
+extern template class MontgomeryIsogeny<GF751>;
+
 }
 
 #endif /* PQC_MONTGOMERY_HPP */
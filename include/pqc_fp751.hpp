@@ -0,0 +1,526 @@
+#ifndef PQC_FP751_HPP
+#define PQC_FP751_HPP
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <type_traits>
+
+#include <gmp.h>
+#include <pqc_gf.hpp>
+
+namespace pqc {
+
+static_assert(GMP_LIMB_BITS == 64, "Fp requires 64-bit GMP limbs");
+
+/* The p751 = 2³⁷²·3²³⁹ - 1 parameter set of the Fp and Fp2 templates.  A
+   parameter set describes a prime p ≡ 3 (mod 4) with 3p < R = 2^(64·limbs)
+   by its limbs, the Montgomery constants and the width of the serialized
+   elements, all as compile-time constants, so that each prime is a
+   distinct type and the element classes carry no pointer to their
+   modulus.  */
+struct P751 {
+	static constexpr std::size_t limbs = 12;
+	static constexpr std::size_t bytes = 94;
+	static constexpr std::size_t bits = 751;
+
+	static constexpr mp_limb_t p[limbs] = {
+		0xffffffffffffffff, 0xffffffffffffffff, 0xffffffffffffffff,
+		0xffffffffffffffff, 0xffffffffffffffff, 0xeeafffffffffffff,
+		0xe3ec968549f878a8, 0xda959b1a13f7cc76, 0x084e9867d6ebe876,
+		0x8562b5045cb25748, 0x0e12909f97badc66, 0x00006fe5d541f71c
+	};
+
+	/* R mod p, that is 1 in Montgomery representation */
+	static constexpr mp_limb_t r[limbs] = {
+		0x00000000000249ad, 0x0000000000000000, 0x0000000000000000,
+		0x0000000000000000, 0x0000000000000000, 0x8310000000000000,
+		0x5527b1e4375c6c66, 0x697797bf3f4f24d0, 0xc89db7b2ac5c4e2e,
+		0x4ca4b439d2076956, 0x10f7926c7512c7e9, 0x00002d5b24bce5e2
+	};
+
+	/* R² mod p, converts into Montgomery representation */
+	static constexpr mp_limb_t r2[limbs] = {
+		0x233046449dad4058, 0xdb010161a696452a, 0x5e36941472e3fd8e,
+		0xf40bfe2082a2e706, 0x4932cca8904f8751, 0x1f735f1f1ee7fc81,
+		0xa24f4d80c1048e18, 0xb56c383ccdb607c5, 0x441dd47b735f9c90,
+		0x5673ed2c6a6ac82a, 0x06c905261132294b, 0x000041ad830f1f35
+	};
+
+	/* R³ mod p, fixes up the result of inversion of a Montgomery residue */
+	static constexpr mp_limb_t r3[limbs] = {
+		0x01541012388dc053, 0x3c5cbed8f06d7f12, 0x788ab3751fc76582,
+		0x60b4e920b9391da9, 0x53519407dee21474, 0x0dbc9303cd18a495,
+		0xa6e87d69312800b2, 0x685c45d4b82e9a1d, 0x7b42f9f1010b7b00,
+		0xbea5f41dc6569f9a, 0x836514d2879ef2ed, 0x0000438a399335fd
+	};
+
+	/* -p⁻¹ mod 2⁶⁴, which is 1 because p ≡ -1 (mod 2⁶⁴) */
+	static constexpr mp_limb_t pinv = 1;
+
+	static const Z& modulus();
+};
+
+/* Element of the prime field of a parameter set, stored in Params::limbs
+   64-bit limbs in Montgomery representation (x·R mod p) and always fully
+   reduced into [0, p).  No operation allocates memory, the multiplication
+   is a schoolbook product followed by Montgomery reduction.  The limb count
+   is a compile-time constant, so the loops over the limbs have fixed trip
+   counts.  */
+template<typename Params>
+class Fp {
+public:
+	static_assert(Params::p[0] % 4 == 3, "Fp requires p ≡ 3 (mod 4)");
+
+	static const std::size_t limbs = Params::limbs;
+	static const std::size_t bytes = Params::bytes;
+	static const std::size_t bits = Params::bits;
+
+	static const Z& modulus() {
+		return Params::modulus();
+	}
+
+	Fp() : v{} {}
+
+	Fp(long x) {
+		set_si(x);
+	}
+
+	Fp(const Z& x) {
+		set_z(x);
+	}
+
+	Z get_z() const;
+
+	Fp& operator+=(const Fp& other) {
+		/* 2p < R, so the sum never carries out of the top limb */
+		mpn_add_n(v, v, other.v, limbs);
+		if (mpn_cmp(v, Params::p, limbs) >= 0)
+			mpn_sub_n(v, v, Params::p, limbs);
+		return *this;
+	}
+
+	Fp operator+(const Fp& other) const {
+		Fp res(*this);
+		res += other;
+		return res;
+	}
+
+	Fp& operator-=(const Fp& other) {
+		if (mpn_sub_n(v, v, other.v, limbs))
+			mpn_add_n(v, v, Params::p, limbs);
+		return *this;
+	}
+
+	Fp operator-(const Fp& other) const {
+		Fp res(*this);
+		res -= other;
+		return res;
+	}
+
+	Fp& negate() {
+		if (!is_zero())
+			mpn_sub_n(v, Params::p, v, limbs);
+		return *this;
+	}
+
+	Fp operator-() const {
+		Fp res(*this);
+		res.negate();
+		return res;
+	}
+
+	Fp& operator*=(const Fp& other) {
+		mul(v, v, other.v);
+		return *this;
+	}
+
+	Fp operator*(const Fp& other) const {
+		Fp res;
+		mul(res.v, v, other.v);
+		return res;
+	}
+
+	Fp& square_inplace() {
+		mul(v, v, v);
+		return *this;
+	}
+
+	Fp& mul_ui(unsigned long);
+
+	Fp square() const {
+		Fp res;
+		mul(res.v, v, v);
+		return res;
+	}
+
+	bool inverse_inplace();
+	Fp pow(const Z&) const;
+	bool is_square() const;
+	Fp& sqrt();
+
+	bool is_zero() const {
+		return mpn_zero_p(v, limbs);
+	}
+
+	explicit operator bool() const {
+		return !is_zero();
+	}
+
+	bool operator==(const Fp& other) const {
+		return mpn_cmp(v, other.v, limbs) == 0;
+	}
+
+	bool operator!=(const Fp& other) const {
+		return mpn_cmp(v, other.v, limbs) != 0;
+	}
+
+	void serialize(unsigned char *) const;
+	void unserialize(const unsigned char *);
+
+	friend std::ostream& operator<<(std::ostream& os, const Fp& x) {
+		os << x.get_z();
+		return os;
+	}
+
+private:
+	template<typename> friend class Fp2;
+
+	void set_si(long);
+	void set_z(const Z&);
+	static void mul(mp_limb_t *, const mp_limb_t *, const mp_limb_t *);
+	static void redc(mp_limb_t *, mp_limb_t *);
+
+	mp_limb_t v[limbs];
+};
+
+/* Quadratic extension Fp(i), i² = -1, with the same interface as GF so
+   that it can be plugged into the curve and isogeny templates.  The modulus
+   arguments of the constructors are accepted only for that compatibility,
+   they have to be equal to Params::modulus().  */
+template<typename Params>
+class Fp2 {
+public:
+	typedef Fp<Params> base_field;
+
+	base_field a, b;
+
+public:
+	static bool check(const Z& p) {
+		return p == base_field::modulus();
+	}
+
+	const Z& get_p() const {
+		return base_field::modulus();
+	}
+
+	Fp2() {}
+
+	Fp2(const Z&) {}
+
+	Fp2(const base_field& _a, const base_field& _b) : a(_a), b(_b) {}
+
+	template<typename Ta, typename = std::enable_if_t<is_z<Ta>::value>>
+	Fp2(const Z&, const Ta& _a) : a(from(_a)) {}
+
+	template<typename Ta, typename Tb,
+		 typename = std::enable_if_t<is_z<Ta>::value>,
+		 typename = std::enable_if_t<is_z<Tb>::value>>
+	Fp2(const Z&, const Ta& _a, const Tb& _b) : a(from(_a)), b(from(_b)) {}
+
+	Fp2(const Z&, const char *_a) : a(Z(_a)) {}
+
+	Fp2(const Z&, const char *_a, const char *_b) : a(Z(_a)), b(Z(_b)) {}
+
+	Fp2& operator+=(const Fp2& other) {
+		a += other.a;
+		b += other.b;
+		return *this;
+	}
+
+	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
+	Fp2& operator+=(const T& other) {
+		a += from(other);
+		return *this;
+	}
+
+	Fp2 operator+(const Fp2& other) const {
+		Fp2 res(*this);
+		res += other;
+		return res;
+	}
+
+	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
+	Fp2 operator+(const T& other) const {
+		Fp2 res(*this);
+		res += other;
+		return res;
+	}
+
+	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
+	friend Fp2 operator+(const T& other, const Fp2& self) {
+		return self + other;
+	}
+
+	Fp2& operator+() {
+		return *this;
+	}
+
+	Fp2& operator-=(const Fp2& other) {
+		a -= other.a;
+		b -= other.b;
+		return *this;
+	}
+
+	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
+	Fp2& operator-=(const T& other) {
+		a -= from(other);
+		return *this;
+	}
+
+	Fp2 operator-(const Fp2& other) const {
+		Fp2 res(*this);
+		res -= other;
+		return res;
+	}
+
+	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
+	Fp2 operator-(const T& other) const {
+		Fp2 res(*this);
+		res -= other;
+		return res;
+	}
+
+	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
+	friend Fp2 operator-(const T& other, const Fp2& self) {
+		return -self + other;
+	}
+
+	Fp2& negate() {
+		a.negate();
+		b.negate();
+		return *this;
+	}
+
+	Fp2 operator-() const {
+		Fp2 res(*this);
+		res.negate();
+		return res;
+	}
+
+	inline Fp2& operator++() {
+		a += base_field(1);
+		return *this;
+	}
+
+	inline Fp2 operator++(int) {
+		Fp2 res(*this);
+		++*this;
+		return res;
+	}
+
+	inline Fp2& operator--() {
+		a -= base_field(1);
+		return *this;
+	}
+
+	inline Fp2 operator--(int) {
+		Fp2 res(*this);
+		--*this;
+		return res;
+	}
+
+	template<typename T, typename = std::enable_if_t<std::is_integral<T>::value>>
+	Fp2& operator*=(const T& other) {
+		if (other < 0) {
+			a.mul_ui(-static_cast<unsigned long>(other));
+			b.mul_ui(-static_cast<unsigned long>(other));
+			negate();
+		} else {
+			a.mul_ui(other);
+			b.mul_ui(other);
+		}
+		return *this;
+	}
+
+	Fp2& operator*=(const Z& other) {
+		base_field c(other);
+		a *= c;
+		b *= c;
+		return *this;
+	}
+
+	Fp2& operator*=(const Fp2& other) {
+		mul(*this, *this, other);
+		return *this;
+	}
+
+	Fp2 operator*(const Fp2& other) const {
+		Fp2 res;
+		mul(res, *this, other);
+		return res;
+	}
+
+	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
+	Fp2 operator*(const T& other) const {
+		Fp2 res(*this);
+		res *= other;
+		return res;
+	}
+
+	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
+	friend Fp2 operator*(const T& other, const Fp2& self) {
+		return self * other;
+	}
+
+	Fp2& square_inplace() {
+		sqr(*this, *this);
+		return *this;
+	}
+
+	Fp2 square() const {
+		Fp2 res;
+		sqr(res, *this);
+		return res;
+	}
+
+	/* 1/(a + bi) = (a - bi) / (a² + b²)  */
+	bool inverse_inplace() {
+		base_field t = a.square() + b.square();
+		if (!t.inverse_inplace())
+			return false;
+		a *= t;
+		b.negate();
+		b *= t;
+		return true;
+	}
+
+	Fp2 inverse() const {
+		Fp2 res(*this);
+		res.inverse_inplace();
+		return res;
+	}
+
+	static bool batch_invert(Fp2 *first, Fp2 *last) {
+		return pqc::batch_invert(first, last);
+	}
+
+	Fp2& operator/=(const Fp2& other) {
+		*this *= other.inverse();
+		return *this;
+	}
+
+	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
+	Fp2& operator/=(const T& other) {
+		base_field d(from(other));
+		d.inverse_inplace();
+		a *= d;
+		b *= d;
+		return *this;
+	}
+
+	Fp2 operator/(const Fp2& other) const {
+		Fp2 res(*this);
+		res /= other;
+		return res;
+	}
+
+	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
+	Fp2 operator/(const T& other) const {
+		Fp2 res(*this);
+		res /= other;
+		return res;
+	}
+
+	Fp2& sqrt();
+
+	Fp2 pow(const Z& exp) const {
+		if (sgn(exp) == 0)
+			return Fp2(base_field(1), base_field());
+		return FixedExponent(exp).pow(*this);
+	}
+
+	bool is_square() const;
+
+	size_t size() const {
+		return 2 * base_field::bytes;
+	}
+
+	/* The buffer variants read and write exactly size() bytes.  */
+	void serialize(unsigned char *) const;
+	bool unserialize(const unsigned char *);
+
+	std::string serialize() const;
+	bool unserialize(const std::string&);
+
+	inline operator bool() const {
+		return !a.is_zero() || !b.is_zero();
+	}
+
+	inline bool operator!() const {
+		return a.is_zero() && b.is_zero();
+	}
+
+	inline bool operator==(const Fp2& other) const {
+		return a == other.a && b == other.b;
+	}
+
+	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
+	inline bool operator==(const T& other) const {
+		return b.is_zero() && a == from(other);
+	}
+
+	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
+	friend inline bool operator==(const T& other, const Fp2& self) {
+		return self == other;
+	}
+
+	inline bool operator!=(const Fp2& other) const {
+		return a != other.a || b != other.b;
+	}
+
+	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
+	inline bool operator!=(const T& other) const {
+		return !(*this == other);
+	}
+
+	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
+	friend inline bool operator!=(const T& other, const Fp2& self) {
+		return self != other;
+	}
+
+	friend std::ostream& operator<<(std::ostream& os, const Fp2& gf) {
+		if (gf.a && gf.b)
+			os << "(" << gf.a << " + " << gf.b << "·i)";
+		else if (gf.a)
+			os << gf.a;
+		else if (gf.b)
+			os << gf.b << "·i";
+		else
+			os << "0";
+		return os;
+	}
+
+private:
+	static void mul(Fp2&, const Fp2&, const Fp2&);
+	static void sqr(Fp2&, const Fp2&);
+
+	template<typename T, typename = std::enable_if_t<std::is_integral<T>::value>>
+	static base_field from(const T& x) {
+		return base_field(static_cast<long>(x));
+	}
+
+	static base_field from(const Z& x) {
+		return base_field(x);
+	}
+};
+
+typedef Fp<P751> Fp751;
+typedef Fp2<P751> GF751;
+
+extern template class Fp<P751>;
+extern template class Fp2<P751>;
+
+}
+
+#endif /* PQC_FP751_HPP */
@@ -3,9 +3,14 @@
 
 #include <functional>
 #include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <list>
+#include <mutex>
 #include <string>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 #include <gmpxx.h>
 
@@ -92,10 +97,10 @@ public:
 		return *this;
 	}
 
+	/* Legendre symbol, which unlike Euler's criterion does not need
+	   an exponentiation.  Zero is not counted as a square.  */
 	bool is_square(const Z& p) const {
-		Z e = (p-1) >> 1;
-		::mpz_powm(e, *this, e, p);
-		return e == 1;
+		return ::mpz_jacobi(*this, p) == 1;
 	}
 
 	std::size_t bit_length() const {
@@ -110,15 +115,162 @@ public:
 		return ::mpz_tstbit(*this, index);
 	}
 
+	/* Little-endian in the given number of bytes, a number which does not
+	   fit is truncated to its low bytes and a negative one is written in
+	   two's complement.  unserialize reads non-negative numbers.  */
+	void serialize(unsigned char *, size_t) const;
+	void unserialize(const unsigned char *, size_t);
+
 	std::string serialize(size_t) const;
 	void unserialize(const std::string&);
 };
 
+/* Precomputed sliding window schedule for raising to a fixed exponent.
+
+   The exponent is cut from the top into windows of at most w bits that
+   start and end with a one bit, so that each window is an odd number u
+   below 2^w.  Raising to the exponent is then a sequence of steps, each of
+   them some squarings followed by a multiplication by x^u, and the odd
+   powers x, x³, ..., x^(2^w - 1) are computed once beforehand.  For the
+   751 bit exponents of SIDH this needs about 130 multiplications instead of
+   about 375 of the binary method, with the same number of squarings.
+
+   pow() works for any type with square_inplace() and operator*=, the
+   exponent has to be positive.  */
+class FixedExponent {
+public:
+	FixedExponent(const Z&);
+
+	template<typename T>
+	T pow(const T& x) const {
+		std::vector<T> powers;
+		powers.reserve(max_power + 1);
+		powers.push_back(x);
+		if (max_power > 0) {
+			T x2 = x.square();
+			for (unsigned i = 1; i <= max_power; ++i)
+				powers.push_back(powers.back() * x2);
+		}
+
+		T res = powers[steps[0].power];
+		for (std::size_t i = 1; i < steps.size(); ++i) {
+			for (unsigned j = 0; j < steps[i].squarings; ++j)
+				res.square_inplace();
+			if (steps[i].power >= 0)
+				res *= powers[steps[i].power];
+		}
+		return res;
+	}
+
+private:
+	struct step {
+		unsigned squarings;
+		/* index into the odd powers, x^(2·power + 1), or -1 for none */
+		int power;
+	};
+
+	std::vector<step> steps;
+	unsigned max_power;
+};
+
+/* Reduction modulo primes of the form p = c·2^k - 1, which is the shape of
+   the SIDH primes l_a^e_a·l_b^e_b·f - 1 with l_a = 2.
+
+   Values x of up to 2n limbs, n being the length of p, are reduced by
+   Barrett's method with the precomputed μ = ⌊2^(128n)/p⌋ of n + 1 limbs:
+     q = ⌊⌊x / 2^(64(n-1))⌋·μ / 2^(64(n+1))⌋,  r = x - q·p
+   where q is at most two below ⌊x/p⌋, so r < 3p and at most two
+   subtractions of p remain.  Only the lower n + 1 limbs of q·p are needed,
+   and with w whole limbs of the 2^k factor and c' = (p + 1) / 2^(64w)
+     q·p = q·c'·2^(64w) - q
+   is a product with c', which is much shorter than p.  Longer values are
+   left to mpz_mod.
+
+   Moduli are registered by add() and looked up by value by GF, so that any
+   GF over a registered prime uses this reduction automatically.  Only the
+   constructors of GF from a modulus look it up, copies and results of
+   arithmetic take the pointer of their operands.  Registered moduli are
+   never removed and are published through an atomic list, so find() takes
+   no lock and add() may run while other threads create GFs, but GFs
+   created before the registration keep the generic reduction.  */
+class SpecialModulus {
+public:
+	static const SpecialModulus *add(const Z&);
+	static const SpecialModulus *find(const Z&);
+
+	/* Returns false for values left to mpz_mod */
+	bool reduce(Z&) const;
+
+	/* The longest moduli add() accepts */
+	static const std::size_t max_limbs = 32;
+
+private:
+	SpecialModulus(const Z& p, std::size_t w) :
+		p(p), c((p + 1) >> (w * GMP_NUMB_BITS)),
+		mu((Z(1) << (2 * GMP_NUMB_BITS * ::mpz_size(p.get_mpz_t()))) / p), w(w), next(nullptr) {}
+
+	Z p, c, mu;
+	std::size_t w;
+	const SpecialModulus *next;
+
+	static std::list<SpecialModulus> registered;
+	static std::atomic<const SpecialModulus *> head;
+	static std::mutex registered_mutex;
+};
+
+/* Inverts all the elements in [first, last) at the cost of one inversion
+   and 3(N - 1) multiplications (Montgomery's trick).  With
+     q_i = x_1·x_2·...·x_i
+   we invert only q_N and then walk backwards computing
+     1/x_i = q_(i-1) · 1/q_i  and  1/q_(i-1) = x_i · 1/q_i.
+   Zero elements are skipped and left as they are, so the caller can find
+   them by testing the elements afterwards.  Returns false if there was any
+   zero element.  */
+template<typename F>
+bool batch_invert(F *first, F *last)
+{
+	std::vector<F> prefix;
+	F *first_nonzero = nullptr;
+	F acc;
+	bool all = true;
+
+	prefix.reserve(last - first);
+	for (F *x = first; x != last; ++x) {
+		prefix.push_back(acc);
+		if (!*x) {
+			all = false;
+		} else if (first_nonzero) {
+			acc *= *x;
+		} else {
+			acc = *x;
+			first_nonzero = x;
+		}
+	}
+
+	if (!first_nonzero)
+		return false;
+
+	acc.inverse_inplace();
+
+	for (F *x = last - 1; x != first_nonzero; --x) {
+		if (!*x)
+			continue;
+		F inv = acc * prefix[x - first];
+		acc *= *x;
+		*x = inv;
+	}
+	*first_nonzero = acc;
+
+	return all;
+}
+
 class GF {
 public:
 	const Z* p;
+	const SpecialModulus* red;
 	Z a, b;
-	static Z t1, t2, t3;
+	/* scratch space, per thread so that arithmetic can run concurrently */
+	static thread_local Z t1, t2, t3;
 
 public:
 	static bool check(const Z& p) {
@@ -129,88 +281,162 @@ public:
 		return *p;
 	}
 
-	GF() : p(nullptr), a(0), b(0) {}
+	GF() : p(nullptr), red(nullptr), a(0), b(0) {}
 
-	GF(const Z& _p) : p(&_p), a(0), b(0) {}
+	GF(const Z& _p) : p(&_p), red(SpecialModulus::find(_p)), a(0), b(0) {}
+
+	/* Copies reserve room for a double width product right away, because
+	   most of them are made to be multiplied into and would otherwise be
+	   reallocated by the first product.  The extra limb is for the carry,
+	   mpz_add and mpz_sub always make room for one.  */
+	GF(const GF& other) : p(other.p), red(other.red) {
+		if (p) {
+			std::size_t bits = (2 * ::mpz_size(*p) + 1) * GMP_NUMB_BITS;
+			::mpz_realloc2(a, bits);
+			::mpz_realloc2(b, bits);
+		}
+		::mpz_set(a, other.a);
+		::mpz_set(b, other.b);
+	}
+
+	GF(GF&&) = default;
+	GF& operator=(const GF&) = default;
+	GF& operator=(GF&&) = default;
 
 	template<typename Ta, typename = std::enable_if_t<is_z<Ta>::value>>
-	GF(const Z& _p, const Ta& _a) : p(&_p), a(_a), b(0) {
-		a %= *p;
+	GF(const Z& _p, const Ta& _a) : p(&_p), red(SpecialModulus::find(_p)), a(_a), b(0) {
+		reduce(a);
 	}
 
 	template<typename Ta, typename Tb,
 		 typename = std::enable_if_t<is_z<Ta>::value>,
 		 typename = std::enable_if_t<is_z<Tb>::value>>
-	GF(const Z& _p, const Ta& _a, const Tb& _b) : p(&_p), a(_a), b(_b) {
-		a %= *p;
-		b %= *p;
+	GF(const Z& _p, const Ta& _a, const Tb& _b) : p(&_p), red(SpecialModulus::find(_p)), a(_a), b(_b) {
+		reduce(a);
+		reduce(b);
 	}
 
-	GF(const Z& _p, const char *_a) : p(&_p), a(_a) {
-		a %= *p;
+	GF(const Z& _p, const char *_a) : p(&_p), red(SpecialModulus::find(_p)), a(_a) {
+		reduce(a);
 	}
 
-	GF(const Z& _p, const char *_a, const char *_b) : p(&_p), a(_a), b(_b) {
-		a %= *p;
-		b %= *p;
+	GF(const Z& _p, const char *_a, const char *_b) : p(&_p), red(SpecialModulus::find(_p)), a(_a), b(_b) {
+		reduce(a);
+		reduce(b);
 	}
 
+	/* Both coefficients are kept in [0, p), so a sum needs at most one
+	   subtraction of p instead of a full division.  */
 	GF& operator+=(const GF& other) {
-		a += other.a;
-		a %= *p;
-		b += other.b;
-		b %= *p;
+		::mpz_add(a, a, other.a);
+		if (::mpz_cmp(a, *p) >= 0)
+			::mpz_sub(a, a, *p);
+		::mpz_add(b, b, other.b);
+		if (::mpz_cmp(b, *p) >= 0)
+			::mpz_sub(b, b, *p);
 		return *this;
 	}
 
 	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
 	GF& operator+=(const T& other) {
 		a += other;
-		a %= *p;
+		reduce(a);
 		return *this;
 	}
 
+	/* The binary operators have overloads for temporary operands, which
+	   compute the result in place of the temporary and move it out, so that
+	   a chained expression like (x.square() + a)*x + b allocates only one
+	   new element instead of one for every subexpression.  */
 	template<typename T, typename = std::enable_if_t<is_z_or_GF<T>::value>>
-	GF operator+(const T& other) const {
+	GF operator+(const T& other) const & {
 		GF res(*this);
 		res += other;
 		return res;
 	}
 
+	template<typename T, typename = std::enable_if_t<is_z_or_GF<T>::value>>
+	GF operator+(const T& other) && {
+		*this += other;
+		return std::move(*this);
+	}
+
+	GF operator+(GF&& other) const & {
+		other += *this;
+		return std::move(other);
+	}
+
+	GF operator+(GF&& other) && {
+		*this += other;
+		return std::move(*this);
+	}
+
 	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
 	friend GF operator+(const T& other, const GF& self) {
 		return self + other;
 	}
 
+	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
+	friend GF operator+(const T& other, GF&& self) {
+		self += other;
+		return std::move(self);
+	}
+
 	GF& operator+() {
 		return *this;
 	}
 
 	GF& operator-=(const GF& other) {
-		a -= other.a;
-		b -= other.b;
-		a %= *p;
-		b %= *p;
+		::mpz_sub(a, a, other.a);
+		if (sgn(a) < 0)
+			::mpz_add(a, a, *p);
+		::mpz_sub(b, b, other.b);
+		if (sgn(b) < 0)
+			::mpz_add(b, b, *p);
 		return *this;
 	}
 
 	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
 	GF& operator-=(const T& other) {
 		a -= other;
-		a %= *p;
+		reduce(a);
 		return *this;
 	}
 
 	template<typename T, typename = std::enable_if_t<is_z_or_GF<T>::value>>
-	GF operator-(const T& other) const {
+	GF operator-(const T& other) const & {
 		GF res(*this);
 		res -= other;
 		return res;
 	}
 
+	template<typename T, typename = std::enable_if_t<is_z_or_GF<T>::value>>
+	GF operator-(const T& other) && {
+		*this -= other;
+		return std::move(*this);
+	}
+
+	GF operator-(GF&& other) const & {
+		other.negate();
+		other += *this;
+		return std::move(other);
+	}
+
+	GF operator-(GF&& other) && {
+		*this -= other;
+		return std::move(*this);
+	}
+
 	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
 	friend GF operator-(const T& other, const GF& self) {
-		return self - other;
+		return -self + other;
+	}
+
+	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
+	friend GF operator-(const T& other, GF&& self) {
+		self.negate();
+		self += other;
+		return std::move(self);
 	}
 
 	GF& negate() {
@@ -227,12 +453,17 @@ public:
 		return *this;
 	}
 
-	GF operator-() const {
+	GF operator-() const & {
 		GF res(*this);
 		res.negate();
 		return res;
 	}
 
+	GF operator-() && {
+		negate();
+		return std::move(*this);
+	}
+
 	inline GF& operator++() {
 		++a;
 		a %= *p;
@@ -260,9 +491,9 @@ public:
 	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
 	GF& operator*=(const T& other) {
 		a *= other;
-		a %= *p;
+		reduce(a);
 		b *= other;
-		b %= *p;
+		reduce(b);
 		return *this;
 	}
 
@@ -286,6 +517,9 @@ public:
 	     ac - bd = T - X + Y,
 	   and the degree 1 coefficient 
 	     ad + bc = X + Y.
+
+	   The products T, X and Y are kept unreduced at double width and each
+	   of the resulting coefficients is reduced only once.
 	   */
 	GF& operator*=(const GF& other) {
 		const Z &c = other.a, &d = other.b;
@@ -294,58 +528,86 @@ public:
 			t1 = a*c - b*d;
 			t2 = a*d + b*c;
 			a = t1;
-			a %= *p;
+			reduce(a);
 			b = t2;
-			b %= *p;
+			reduce(b);
 			return *this;
 		}
 
-		t1 = a - b;
-		t2 = c + d;
-		t3 = (t1 * t2);
-		t1 = a * d;
-		t2 = b * c;
-		a = t3 - t1 + t2;
-		a %= *p;
-		b = t1 + t2;
-		b %= *p;
+		::mpz_sub(t1, a, b);
+		::mpz_add(t2, c, d);
+		::mpz_mul(t3, t1, t2);
+		::mpz_mul(t1, a, d);
+		::mpz_mul(t2, b, c);
+		::mpz_sub(a, t3, t1);
+		::mpz_add(a, a, t2);
+		reduce(a);
+		::mpz_add(b, t1, t2);
+		reduce(b);
 		return *this;
 	}
 
 	template<typename T, typename = std::enable_if_t<is_z_or_GF<T>::value>>
-	GF operator*(const T& other) const {
+	GF operator*(const T& other) const & {
 		GF res(*this);
 		res *= other;
 		return res;
 	}
 
+	template<typename T, typename = std::enable_if_t<is_z_or_GF<T>::value>>
+	GF operator*(const T& other) && {
+		*this *= other;
+		return std::move(*this);
+	}
+
+	GF operator*(GF&& other) const & {
+		other *= *this;
+		return std::move(other);
+	}
+
+	GF operator*(GF&& other) && {
+		*this *= other;
+		return std::move(*this);
+	}
+
 	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
 	friend GF operator*(const T& other, const GF& self) {
 		return self * other;
 	}
 
+	template<typename T, typename = std::enable_if_t<is_z<T>::value>>
+	friend GF operator*(const T& other, GF&& self) {
+		self *= other;
+		return std::move(self);
+	}
+
 	/* Substituting into the result of multiplication the result should be
 	     2abx + (a²-b²) = (ab + ab)·x + (a+b)·(a-b) = (X + X)·x + Y·Z,
 	   where
 	     X = ab, Y = (a + b) and Z = (a - b),
 	   thus we need only two multiplications.  */
 	GF& square_inplace() {
-		t1 = a + b;
-		t2 = a - b;
-		b *= a;
-		b += b;
-		b %= *p;
-		a = t1*t2;
-		a %= *p;
+		::mpz_add(t1, a, b);
+		::mpz_sub(t2, a, b);
+		::mpz_mul(b, b, a);
+		::mpz_mul_2exp(b, b, 1);
+		reduce(b);
+		::mpz_mul(a, t1, t2);
+		reduce(a);
 		return *this;
 	}
 
-	GF square() const {
+	GF square() const & {
 		GF res(*this);
 		res.square_inplace();
 		return res;
 	}
 
+	GF square() && {
+		square_inplace();
+		return std::move(*this);
+	}
+
 	/* We want to compute 1/(a+bx)
 	     1 / (a + bx) = (a - bx) / [(a + bx)·(a - bx)]
 	                  = (a - bx) / (a² - b²x²)
@@ -358,27 +620,35 @@ public:
 	
 	   Thus the result is (a - bx) / (a² + b²).  */
 	bool inverse_inplace() {
-		t1 = a*a;
+		::mpz_mul(t1, a, a);
 		/* t1 += b*b;   addmul is faster */
-		t1.addmul(b, b);
-		t2 = t1;
-		if (t2.invert(*p) == 0)
+		::mpz_addmul(t1, b, b);
+		if (::mpz_invert(t2, t1, *p) == 0)
 			return false;
 
-		a *= t2;
-		a %= *p;
-		b = -b;
-		b *= t2;
-		b %= *p;
+		::mpz_mul(a, a, t2);
+		reduce(a);
+		::mpz_neg(b, b);
+		::mpz_mul(b, b, t2);
+		reduce(b);
 		return true;
 	}
 
-	GF inverse() const {
+	GF inverse() const & {
 		GF res(*this);
 		res.inverse_inplace();
 		return res;
 	}
 
+	GF inverse() && {
+		inverse_inplace();
+		return std::move(*this);
+	}
+
+	static bool batch_invert(GF *first, GF *last) {
+		return pqc::batch_invert(first, last);
+	}
+
 	GF& operator/=(const GF& other) {
 		*this *= other.inverse();
 		return *this;
@@ -393,12 +663,18 @@ public:
 	}
 
 	template<typename T, typename = std::enable_if_t<is_z_or_GF<T>::value>>
-	GF operator/(const T& other) const {
+	GF operator/(const T& other) const & {
 		GF res(*this);
 		res /= other;
 		return res;
 	}
 
+	template<typename T, typename = std::enable_if_t<is_z_or_GF<T>::value>>
+	GF operator/(const T& other) && {
+		*this /= other;
+		return std::move(*this);
+	}
+
 	/* We have
 	     (a + bx)² = c + dx,
 	   that is
@@ -419,50 +695,89 @@ public:
 	     a² - d²/(4a²) = c
 	     4a⁴ - 4ca² - d² = 0
 	   This has the solutions
-	     a² = (c ± sqrt(c² + d²)) / 2
-	   Thus we at first try
-	     a² = (c + sqrt(c² + d²)) / 2,
-	   and if this is not a square in the field over p, we try
-	     a² = (c - sqrt(c² + d²)) / 2.
+	     a² = (c ± n) / 2,  where n = sqrt(c² + d²).
+	   The product of the two candidates is (c² - n²)/4 = -d²/4, and since
+	   -1 is not a square for p ≡ 3 (mod 4), exactly one of them is a square
+	   if d ≠ 0.  So we compute s = t^((p+1)/4) for t = (c + n)/2, which is
+	   either the square root of t or of -t.  In the first case a = s, in
+	   the second case
+	     a² = (c - n)/2 = -d²/(4t) = d²/(4s²),  so a = d/(2s),
+	   and then b = d/(2a) = s.  This needs no test of quadratic residuosity
+	   and only two square roots in the field over p.
+
+	   If d = 0, the root is either sqrt(c) or sqrt(-c)·x.
 	   */
 	GF& sqrt() {
-		t1 = a*a;
-		t1.addmul(b, b);
+		if (sgn(b) == 0) {
+			if (a.is_square(*p)) {
+				a.sqrtmod(*p);
+			} else {
+				::mpz_neg(b, a);
+				reduce(b);
+				b.sqrtmod(*p);
+				a = 0;
+			}
+			return *this;
+		}
+
+		::mpz_mul(t1, a, a);
+		::mpz_addmul(t1, b, b);
+		reduce(t1);
 		t1.sqrtmod(*p);
-		t3 = 2;
-		t3.invert(*p);
-		t2 = ((t1 + a) * t3) % *p;
-		if (!t2.is_square(*p))
-			t2 = ((t1 - a) * t3) % *p;
-		t2.sqrtmod(*p);
-		a = t2;
-		t2 <<= 1;
-		t2.invert(*p);
-		b *= t2;
-		b %= *p;
+
+		/* t2 = (a + n)/2 */
+		::mpz_add(t2, a, t1);
+		if (t2.testbit(0))
+			::mpz_add(t2, t2, *p);
+		::mpz_tdiv_q_2exp(t2, t2, 1);
+		if (::mpz_cmp(t2, *p) >= 0)
+			::mpz_sub(t2, t2, *p);
+
+		::mpz_set(t3, t2);
+		t3.sqrtmod(*p);
+
+		/* t1 = d/(2s) */
+		::mpz_mul_2exp(t1, t3, 1);
+		::mpz_invert(t1, t1, *p);
+		::mpz_mul(t1, t1, b);
+		reduce(t1);
+
+		/* b is no longer needed, use it to check whether s² = t */
+		::mpz_mul(b, t3, t3);
+		reduce(b);
+		if (b == t2) {
+			::mpz_swap(a, t3);
+			::mpz_swap(b, t1);
+		} else {
+			::mpz_swap(a, t1);
+			::mpz_swap(b, t3);
+		}
 		return *this;
 	}
 
 	GF pow(const Z& exp) const {
-		GF q(*this);
-		GF res = exp.testbit(0) ? *this : GF(*p, 1, 0);
-		for (std::size_t i = 1; i < exp.bit_length(); ++i) {
-			q.square_inplace();
-			if (exp.testbit(i))
-				res *= q;
-		}
-		return res;
+		if (sgn(exp) == 0)
+			return GF(*p, 1, 0);
+		return FixedExponent(exp).pow(*this);
 	}
 
+	/* a + bx is a square in the field over p² exactly if its norm a² + b²
+	   is a square in the field over p, so instead of exponentiating by
+	   (p² - 1)/2 a Legendre symbol of the norm suffices.  */
 	bool is_square() const {
-		Z exp = (*p * *p - 1) >> 1;
-		return this->pow(exp) == 1;
+		::mpz_mul(t1, a, a);
+		::mpz_addmul(t1, b, b);
+		return t1.is_square(*p);
 	}
 
 	size_t size() const {
 		return 2 * p->size();
 	}
 
+	/* The buffer variants read and write exactly size() bytes.  */
+	void serialize(unsigned char *) const;
+	bool unserialize(const unsigned char *);
+
 	std::string serialize() const;
 	bool unserialize(const std::string&);
 
@@ -569,6 +884,14 @@ public:
 			os << "0";
 		return os;
 	}
+
+private:
+	void reduce(Z& x) const {
+		if (red)
+			red->reduce(x);
+		else
+			x %= *p;
+	}
 };
 
 }
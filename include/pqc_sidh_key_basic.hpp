@@ -5,6 +5,7 @@
 #include <pqc_asymmetric_key.hpp>
 #include <pqc_sidh_params.hpp>
 #include <pqc_weierstrass.hpp>
+#include <montgomery.hpp>
 
 namespace pqc
 {
@@ -12,6 +13,17 @@ namespace pqc
 class sidh_key_basic : public asymmetric_key
 {
 public:
+	typedef sidh_params::field field;
+
+	/* The isogenies can be computed on the short Weierstrass curves of the
+	   public key format, or on Montgomery models of them with projective
+	   x-only arithmetic (see MontgomeryIsogeny), which is much faster.
+	   Both give the same shared secrets.  */
+	enum class engine {
+		WEIERSTRASS,
+		MONTGOMERY
+	};
+
 	sidh_key_basic(const sidh_params&);
 	virtual ~sidh_key_basic();
 
@@ -23,6 +35,16 @@ public:
 	virtual bool import_public(const std::string&);
 	virtual bool import(const std::string&);
 
+	/* The same formats written into and read from caller-provided
+	   buffers of exactly private_size() and public_size() bytes.  */
+	size_t private_size() const;
+	size_t public_size() const;
+
+	bool write_private(unsigned char *) const;
+	bool write_public(unsigned char *) const;
+	bool read_private(const unsigned char *);
+	bool read_public(const unsigned char *);
+
 	virtual bool generate_private();
 	virtual bool generate_public();
 	virtual void generate();
@@ -31,24 +53,42 @@ public:
 
 	const sidh_params& get_params() const;
 
+	engine get_engine() const;
+	void set_engine(engine);
+
 	// private part
 	const Z& get_m() const;
 	const Z& get_n() const;
-	const WeierstrassIsogeny& get_isogeny();
+	/* The whole chain of the isogeny, computed on demand and kept with
+	   the key.  Generating keys and shared secrets does not need it,
+	   those only stream the points through the walk.  */
+	const WeierstrassIsogeny<field>& get_isogeny();
 
 	// public part
-	const WeierstrassPoint& get_P_image() const;
-	const WeierstrassPoint& get_Q_image() const;
-	const WeierstrassCurvePtr& get_curve_image() const;
+	/* The points refer to the curve of the key by a plain handle (see
+	   CurveHandle): they, and copies of them, must not outlive the key,
+	   nor be used after the key is regenerated or imported into, as that
+	   replaces the curve.  Keep get_curve_image() alongside to hold the
+	   curve longer.  */
+	const WeierstrassPoint<field>& get_P_image() const;
+	const WeierstrassPoint<field>& get_Q_image() const;
+	const WeierstrassCurvePtr<field>& get_curve_image() const;
 private:
 	bool ensure_has_isogeny();
+	bool generate_public_montgomery();
+	std::string compute_shared_secret_montgomery(const sidh_key_basic&) const;
+	WeierstrassPoint<field> fixed_base_generator(const sidh_params::precomputation&) const;
+	MontgomeryPoint<field> kernel_generator(MontgomeryCurveHandle<field>, const WeierstrassPoint<field>&, const WeierstrassPoint<field>&) const;
+	MontgomeryCurvePtr<field> montgomery_model(const WeierstrassPoint<field>&, const WeierstrassPoint<field>&) const;
+	MontgomeryCurvePtr<field> montgomery_model(const WeierstrassCurveConstPtr<field>&) const;
 
+	engine engine_;
 	bool has_isogeny_;
 	const sidh_params params_;
 	Z m_, n_;
-	WeierstrassIsogeny isogeny_;
-	WeierstrassCurvePtr curve_;
-	WeierstrassPoint P_image_, Q_image_;
+	WeierstrassIsogeny<field> isogeny_;
+	WeierstrassCurvePtr<field> curve_;
+	WeierstrassPoint<field> P_image_, Q_image_;
 };
 
 }
@@ -1,8 +1,12 @@
 #ifndef PQC_SIDH_PARAMS_HPP
 #define PQC_SIDH_PARAMS_HPP
 
+#include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 #include <pqc_weierstrass.hpp>
+#include <montgomery.hpp>
 
 namespace pqc
 {
@@ -15,25 +19,88 @@ public:
 		B
 	};
 
+	/* The field the curves and points are defined over, that is the
+	   quadratic extension over the prime of this parameter set.  */
+	typedef GF751 field;
+
 	sidh_params() = delete;
 	sidh_params(side);
 
 	sidh_params other_side() const;
 
 	side s;
+
+	/* The strategies of the isogeny walks of this side: at a point with h
+	   steps to go, the walk multiplies it to the point with strategy[h]
+	   steps to go.  strategy is for WeierstrassIsogeny with e steps of
+	   degree l, montgomery_strategy for MontgomeryIsogeny, which takes
+	   steps of degree 4 on side A.  */
 	const std::vector<int>& strategy;
+	const std::vector<int>& montgomery_strategy;
 	const int &l, &e;
 	const Z &prime, &le, &lem1;
-	const WeierstrassPoint &P, &Q, &P_peer, &Q_peer;
+	const WeierstrassPoint<field> &P, &Q, &P_peer, &Q_peer;
+
+	/* What the key generation of both sides can do in advance: comb tables
+	   for the multiples of Pa, Qa, Pb and Qb, the points Ta and Ua of order
+	   two below Pa and Qa, and the Montgomery models of E in which they are
+	   (0, 0).  Built at the first use, unless import_tables was given the
+	   result of an earlier export_tables, e.g. saved in a file.  The
+	   export is deterministic, and imported tables are rejected unless
+	   their SHA-256 is the one of the tables built here, which is pinned
+	   in the source.  */
+	struct precomputation {
+		WeierstrassFixedBase<field> Pa, Qa, Pb, Qb;
+		WeierstrassPoint<field> Ta, Ua;
+		MontgomeryCurveConstPtr<field> model_Pa, model_Qa;
+	};
+
+	static std::shared_ptr<const precomputation> precomputed();
+	static std::string export_tables();
+	static bool import_tables(const std::string&);
+
+	/* The costs of multiplying a point by the degree of a step and of
+	   evaluating the isogeny of a step at a point, in any common unit */
+	struct walk_cost {
+		double mul, eval;
+	};
+
+	/* The costs of the four walks, indexed by the side */
+	struct costs {
+		walk_cost weierstrass[2], montgomery[2];
+	};
+
+	/* The strategy of the least total cost for a walk of the given number
+	   of steps, by dynamic programming over the split of each subtree:
+	     C(h) = min (C(s) + C(h - s) + (h - s)·mul + s·eval),  0 < s < h  */
+	static std::vector<int> optimal_strategy(int steps, const walk_cost&);
+
+	/* The strategies are computed from default_costs(), measured on x86-64
+	   with the GF751 arithmetic.  autotune() replaces them with strategies
+	   for costs measured by measure_costs() on the running machine,
+	   set_costs() with ones from an earlier measurement.  Neither may run
+	   concurrently with isogeny walks.  */
+	static costs default_costs();
+	static costs measure_costs();
+	static void set_costs(const costs&);
+	static void autotune();
 
 private:
 	static void initialize();
+	static void do_initialize();
+	static void compute_strategies(const costs&);
 
-	static std::vector<int> s_strategy;
+	static std::vector<int> s_strategy[2], s_montgomery_strategy[2];
 	static int la, ea, lb, eb;
 	static Z p, lea, leam1, leb, lebm1;
-	static WeierstrassCurveConstPtr E;
-	static WeierstrassPoint Pa, Qa, Pb, Qb;
+	static WeierstrassCurveConstPtr<field> E;
+	static WeierstrassPoint<field> Pa, Qa, Pb, Qb;
+
+	static std::shared_ptr<precomputation> empty_tables();
+	static bool finish_tables(precomputation&);
+
+	static std::mutex s_tables_mutex;
+	static std::shared_ptr<const precomputation> s_tables;
 };
 
 }
@@ -0,0 +1,59 @@
+#ifndef PQC_THREAD_POOL_HPP
+#define PQC_THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pqc
+{
+
+/* A fixed set of worker threads for splitting one loop at a time.  The
+   caller of run works on the loop too, so a pool of n threads starts n - 1
+   workers.  Loops shorter than threshold, and loops given while the pool
+   is busy with another one, are run serially by the caller, so that many
+   concurrent users degrade to their own threads instead of queuing.  */
+class thread_pool
+{
+public:
+	thread_pool(unsigned threads, std::size_t threshold = 8);
+	~thread_pool();
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	unsigned threads() const;
+	std::size_t threshold() const;
+
+	/* Calls f(first, last) for consecutive ranges covering [0, n), at
+	   most one per thread, and returns when all of them are done.  */
+	void run(std::size_t n, const std::function<void(std::size_t, std::size_t)>& f);
+
+	/* The pool the isogeny walks spread the evaluations of their steps
+	   over, none by default.  The walks take it when they start.  */
+	static std::shared_ptr<thread_pool> isogeny_pool();
+	static void set_isogeny_pool(std::shared_ptr<thread_pool>);
+
+private:
+	void work();
+	void worker();
+
+	std::vector<std::thread> workers_;
+	std::size_t threshold_;
+
+	std::mutex busy_;
+	std::mutex mutex_;
+	std::condition_variable start_, done_;
+	const std::function<void(std::size_t, std::size_t)> *job_;
+	std::size_t n_, chunks_, next_, pending_;
+	unsigned long generation_;
+	bool stop_;
+};
+
+}
+
+#endif /* PQC_THREAD_POOL_HPP */
@@ -1,10 +1,14 @@
 #ifndef PQC_WEIERSTRASS_HPP
 #define PQC_WEIERSTRASS_HPP
 
+#include <algorithm>
 #include <memory>
+#include <string>
 #include <vector>
 #include <utility>
 #include <pqc_gf.hpp>
+#include <pqc_fp751.hpp>
+#include <pqc_thread_pool.hpp>
 
 namespace pqc {
 
@@ -35,38 +39,120 @@ namespace pqc {
 
  */
 
-class WeierstrassCurve;
-class WeierstrassPoint;
-class WeierstrassSmallIsogeny;
+/* The curve, point and isogeny classes are templates over the field of
+   definition: GF for an arbitrary prime given at runtime and GF751, the
+   fixed-width Fp2 over the prime of sidh_params.  Both are explicitly
+   instantiated in pqc_weierstrass.cpp.  */
+
+/* How WeierstrassPoint::multiply goes through the scalar: the ladder of
+   operator*, which does the same operations for every bit and is meant
+   for secret scalars, a plain left to right double and add, or its
+   width-w NAF with a table of the odd multiples up to (2^(w-1) - 1)·P,
+   which takes about bits/(w + 1) additions instead of bits/2.  The latter
+   two depend on the bits of the scalar and are for public ones only.  */
+enum class multiplication_policy {
+	LADDER,
+	DOUBLE_AND_ADD,
+	WNAF
+};
 
-class WeierstrassCurve : public std::enable_shared_from_this<WeierstrassCurve> {
-	GF a, b;
+template<typename F> class WeierstrassCurve;
+template<typename F> class WeierstrassPoint;
+template<typename F> class WeierstrassJacobianPoint;
+template<typename F> class WeierstrassFixedBase;
+template<typename F> class WeierstrassSmallIsogeny;
+template<typename F> class MontgomeryCurve;
+template<typename F> class MontgomeryPoint;
+
+/* What a point keeps of its curve: a plain pointer, so that copying points
+   and making temporaries does not touch an atomic reference count.  The
+   curve is owned elsewhere, by a shared_ptr or by the arena of a
+   WeierstrassIsogeny, which has to outlive the points.  The constructors
+   are explicit, so that a temporary shared_ptr cannot silently become a
+   handle to a curve freed at the end of the expression.  */
+template<typename Curve>
+class CurveHandle {
+	const Curve *m_curve;
 public:
-	friend class WeierstrassPoint;
-	friend class WeierstrassSmallIsogeny;
+	CurveHandle() : m_curve(nullptr) {}
+	explicit CurveHandle(const Curve *curve) : m_curve(curve) {}
+	explicit CurveHandle(const std::shared_ptr<Curve>& curve) : m_curve(curve.get()) {}
+	explicit CurveHandle(const std::shared_ptr<const Curve>& curve) : m_curve(curve.get()) {}
 
-	WeierstrassCurve(const GF& _a, const GF& _b) : a(_a), b(_b) {}
-	WeierstrassCurve(const Z& p) : a(p), b(p) {}
+	const Curve *get() const {
+		return m_curve;
+	}
 
-	GF j_invariant() const {
-		GF a3m4 = 4*a.square()*a;
-		return 1728 * a3m4 / (a3m4 + 27*b.square());
+	const Curve& operator*() const {
+		return *m_curve;
 	}
 
-	WeierstrassSmallIsogeny small_isogeny (const WeierstrassPoint& generator, int l) const;
+	const Curve *operator->() const {
+		return m_curve;
+	}
 
-	std::string serialize() const {
-		return a.serialize() + b.serialize();
+	explicit operator bool() const {
+		return m_curve != nullptr;
+	}
+
+	bool operator==(const CurveHandle& other) const {
+		return m_curve == other.m_curve;
+	}
+
+	bool operator!=(const CurveHandle& other) const {
+		return m_curve != other.m_curve;
 	}
+};
+
+template<typename F> using WeierstrassCurveHandle = CurveHandle<WeierstrassCurve<F>>;
+
+template<typename F>
+class WeierstrassCurve {
+	F a, b;
+public:
+	friend class WeierstrassPoint<F>;
+	friend class WeierstrassJacobianPoint<F>;
+	friend class WeierstrassSmallIsogeny<F>;
+	friend class MontgomeryCurve<F>;
+
+	WeierstrassCurve(const F& _a, const F& _b) : a(_a), b(_b) {}
+	WeierstrassCurve(const Z& p) : a(p), b(p) {}
+
+	F j_invariant() const {
+		F a3m4 = 4*a.square()*a;
+		return 1728 * a3m4 / (a3m4 + 27*b.square());
+	}
+
+	/* The isogeny of degree l = 2, 3 or 4 with kernel generated by
+	   generator.  The image is stored into image, which has to outlive
+	   the result and the points mapped by it.  */
+	WeierstrassSmallIsogeny<F> small_isogeny (const WeierstrassJacobianPoint<F>& generator, int l, WeierstrassCurve& image) const;
+	WeierstrassSmallIsogeny<F> small_isogeny (const WeierstrassPoint<F>& generator, int l, WeierstrassCurve& image) const;
 
 	size_t size() const {
 		return 2*a.size();
 	}
 
+	/* The buffer variants read and write exactly size() bytes.  */
+	void serialize(unsigned char *buffer) const {
+		a.serialize(buffer);
+		b.serialize(buffer + a.size());
+	}
+
+	bool unserialize(const unsigned char *buffer) {
+		return a.unserialize(buffer) && b.unserialize(buffer + a.size());
+	}
+
+	std::string serialize() const {
+		std::string result(size(), 0);
+		serialize(reinterpret_cast<unsigned char *>(&result[0]));
+		return result;
+	}
+
 	bool unserialize(const std::string& raw) {
 		if (raw.size() != size())
 			return false;
-		return a.unserialize(raw.substr(0, a.size())) && b.unserialize(raw.substr(a.size()));
+		return unserialize(reinterpret_cast<const unsigned char *>(raw.data()));
 	}
 
 	friend std::ostream& operator<<(std::ostream& os, const WeierstrassCurve& curve) {
@@ -74,48 +160,73 @@ public:
 		return os;
 	}
 
-
-	std::pair<WeierstrassPoint, WeierstrassPoint> basis(int la, int ea, int lb, int eb, int f) const;
+	/* A basis of the la^ea-torsion of a curve of order (la^ea·lb^eb·f)²,
+	   two torsion points whose reduced Tate pairing has order la^ea.  */
+	std::pair<WeierstrassPoint<F>, WeierstrassPoint<F>> basis(int la, int ea, int lb, int eb, int f,
+								 multiplication_policy policy = multiplication_policy::WNAF) const;
+
+	/* The same without randomness: the points come from the x coordinates
+	   k + k²·i, k = 1, 2, ..., each on the curve about every other time.
+	   Not from a line like k + i, along which x - α can have the same
+	   quadratic character for a root α of x³ + a·x + b, as for α = i on
+	   y² = x³ + x, and Q below would never be found.  P is
+	   the first whose multiple has order la^ea, which is three in four
+	   candidates.  For the l-part of the curve being (Z/l^e)², Q is
+	   independent of P exactly if its image in E/lE is not in the one of
+	   <P>, which is when t_l(T, Q) ≠ 1 for T = l^(e-1)·P.  That pairing of
+	   order l is a Miller loop of a few steps, so every candidate for Q
+	   but the one taken costs no scalar multiplication, and none of them
+	   a pairing of order la^ea.  The result depends only on the curve.  */
+	std::pair<WeierstrassPoint<F>, WeierstrassPoint<F>> deterministic_basis(int la, int ea, int lb, int eb, int f) const;
+
+	/* A random point multiplied by cofactor, such that its multiple by
+	   factor_div_p is not the identity.  The multiplications are done
+	   according to policy.  */
+	WeierstrassPoint<F> torsion_point(const Z& cofactor, const Z& factor_div_p,
+					  multiplication_policy policy = multiplication_policy::WNAF) const;
 private:
-	WeierstrassPoint random_point() const;
-	WeierstrassPoint torsion_point(const Z&, const Z&) const;
+	WeierstrassPoint<F> random_point() const;
+
+	/* The point with the given x coordinate and the square root of
+	   x³ + a·x + b as y, or the identity if there is none */
+	WeierstrassPoint<F> point_at(const F& x) const;
 };
 
-typedef std::shared_ptr<WeierstrassCurve> WeierstrassCurvePtr;
-typedef std::shared_ptr<const WeierstrassCurve> WeierstrassCurveConstPtr;
+template<typename F> using WeierstrassCurvePtr = std::shared_ptr<WeierstrassCurve<F>>;
+template<typename F> using WeierstrassCurveConstPtr = std::shared_ptr<const WeierstrassCurve<F>>;
 
+template<typename F>
 class WeierstrassPoint {
-	WeierstrassCurveConstPtr m_curve;
-	GF x, y;
+	WeierstrassCurveHandle<F> m_curve;
+	F x, y;
 	bool identity;
 public:
-	friend class WeierstrassCurve;
-	friend class WeierstrassSmallIsogeny;
+	friend class WeierstrassCurve<F>;
+	friend class WeierstrassJacobianPoint<F>;
+	friend class WeierstrassSmallIsogeny<F>;
+	friend class MontgomeryCurve<F>;
+	friend class MontgomeryPoint<F>;
 
-	WeierstrassPoint() {}
+	WeierstrassPoint() : identity(true) {}
 
-	WeierstrassPoint(const Z& p) :
-		m_curve(std::make_shared<WeierstrassCurve>(p)), x(p), y(p), identity(true) {}
+	WeierstrassPoint(WeierstrassCurveHandle<F> curve, F x, F y) :
+		m_curve(curve), x(std::move(x)), y(std::move(y)), identity(false) {}
 
-	WeierstrassPoint(const WeierstrassCurveConstPtr& curve, const GF& x, const GF& y) :
-		m_curve(curve), x(x), y(y), identity(false) {}
-
-	WeierstrassPoint(const WeierstrassCurveConstPtr& curve, const GF& x) :
+	WeierstrassPoint(WeierstrassCurveHandle<F> curve, const F& x) :
 		m_curve(curve), x(x), identity(false) {
 
 		y = (x.square() + m_curve->a)*x + m_curve->b;
 		if (!y.is_square()) {
-			m_curve.reset();
+			m_curve = WeierstrassCurveHandle<F>();
 			return;
 		}
 
 		y.sqrt();
 	}
 
-	WeierstrassPoint(const WeierstrassCurveConstPtr& curve) : m_curve(curve), x(curve->a.get_p()), y(curve->a.get_p()), identity(true) {}
-	WeierstrassPoint(const WeierstrassCurvePtr& curve) : m_curve(curve), x(curve->a.get_p()), y(curve->a.get_p()), identity(true) {}
+	WeierstrassPoint(WeierstrassCurveHandle<F> curve) : m_curve(curve), x(curve->a.get_p()), y(curve->a.get_p()), identity(true) {}
 
-	const WeierstrassCurveConstPtr& curve() const {
+	WeierstrassCurveHandle<F> curve() const {
 		return m_curve;
 	}
 
@@ -131,29 +242,43 @@ public:
 		return 1 + 2*x.size();
 	}
 
-	std::string serialize() const {
+	/* The buffer variants read and write exactly size() bytes, a zero
+	   tag byte followed by zeros for the identity, otherwise the tag one
+	   and the coordinates.  */
+	void serialize(unsigned char *buffer) const {
 		if (identity) {
-			return std::string(1 + size(), 0x00);
+			std::fill(buffer, buffer + size(), 0x00);
 		} else {
-			return ((char) 0x01) + x.serialize() + y.serialize();
+			buffer[0] = 0x01;
+			x.serialize(buffer + 1);
+			y.serialize(buffer + 1 + x.size());
 		}
 	}
 
-	bool unserialize(const std::string& raw) {
-		size_t half = x.size();
-		if (raw.size() != 2*half+1) {
-			return false;}
-		if (raw[0] == 0x00) {
+	bool unserialize(const unsigned char *buffer) {
+		if (buffer[0] == 0x00) {
 			identity = true;
 			return true;
-		} else if (raw[0] == 0x01) {
+		} else if (buffer[0] == 0x01) {
 			identity = false;
-			return x.unserialize(raw.substr(1, half)) && y.unserialize(raw.substr(1 + half));
+			return x.unserialize(buffer + 1) && y.unserialize(buffer + 1 + x.size());
 		} else {
 			return false;
 		}
 	}
 
+	std::string serialize() const {
+		std::string result(size(), 0);
+		serialize(reinterpret_cast<unsigned char *>(&result[0]));
+		return result;
+	}
+
+	bool unserialize(const std::string& raw) {
+		if (raw.size() != size())
+			return false;
+		return unserialize(reinterpret_cast<const unsigned char *>(raw.data()));
+	}
+
 	bool operator==(const WeierstrassPoint& other) const {
 		if (identity)
 			return other.identity;
@@ -180,25 +305,34 @@ public:
 	}
 
 	WeierstrassPoint operator+(const WeierstrassPoint& other) const {
-		const GF &x1 = x, &y1 = y, &x2 = other.x, &y2 = other.y;
-		if (identity) {
-			return other;
-		} else if (other.identity) {
-			return *this;
-		} else if (x1 == x2) {
-			if (y1 == -y2) {
-				return WeierstrassPoint(m_curve);
-			} else {
-				GF lambda = (3*x1.square() + m_curve->a) / (2*y1);
-				GF x3 = lambda.square() - x1 - x1;
-				GF y3 = lambda*(x1 - x3) - y1;
-				return WeierstrassPoint(m_curve, x3, y3);
-			}
-		} else {
-			GF lambda = (y2 - y1) / (x2 - x1);
-			GF x3 = lambda.square() - x1 - x2;
-			GF y3 = lambda*(x1 - x3) - y1;
-			return WeierstrassPoint(m_curve, x3, y3);
+		WeierstrassPoint res;
+		F num, den;
+
+		if (!slope(other, num, den, res))
+			return res;
+
+		num /= den;
+		return add_with_slope(other, num);
+	}
+
+	/* Computes R[i] = P[i] + Q[i] for all i < n, sharing one inversion of
+	   the slope denominators among all the sums.  R may be the same array
+	   as P or Q.  */
+	static void add_batch(const WeierstrassPoint *P, const WeierstrassPoint *Q, WeierstrassPoint *R, std::size_t n) {
+		std::vector<WeierstrassPoint> res(n);
+		std::vector<F> num(n), den(n);
+		std::vector<bool> sloped(n);
+
+		for (std::size_t i = 0; i < n; ++i)
+			sloped[i] = P[i].slope(Q[i], num[i], den[i], res[i]);
+
+		F::batch_invert(den.data(), den.data() + n);
+
+		for (std::size_t i = 0; i < n; ++i) {
+			if (sloped[i])
+				R[i] = P[i].add_with_slope(Q[i], num[i] *= den[i]);
+			else
+				R[i] = res[i];
 		}
 	}
 
@@ -218,20 +352,26 @@ public:
 		return res;
 	}
 
-	/* multiply by montgomery ladder */
-	WeierstrassPoint operator*(const Z& n) const {
-		WeierstrassPoint R0(m_curve), R1(*this);
-		for (std::ptrdiff_t i = n.bit_length() - 1; i >= 0; --i) {
-			if (n.testbit(i)) {
-				R0 += R1;
-				R1 += R1;
-			} else {
-				R1 += R0;
-				R0 += R0;
-			}
-		}
-		return R0;
-	}
+	/* The ladder, computed in Jacobian coordinates, see
+	   WeierstrassJacobianPoint, so that only the result is inverted.  */
+	WeierstrassPoint operator*(const Z& n) const;
+
+	/* n·P by the given policy, operator* is the ladder one.  The
+	   wNAF table is normalized with a single inversion so that its
+	   additions are mixed ones, the width is chosen by the length of n
+	   if 0 and clamped to 2..8 otherwise, as the table has 2^(width - 2)
+	   entries.  */
+	WeierstrassPoint multiply(const Z& n, multiplication_policy policy, int width = 0) const;
+
+	/* Multiplies by base^exp, one small multiplication at a time without
+	   leaving Jacobian coordinates.  */
+	WeierstrassPoint multiply_by_power(int base, int exp) const;
+
+	/* m·P + n·Q by Straus' method (Shamir's trick): one double and add pass
+	   over the bits of both scalars together, adding P, Q or P + Q, instead
+	   of two separate multiplications.  The addition is computed for every
+	   bit, also where it is dropped, as m and n are secret keys.  */
+	static WeierstrassPoint linear_combination(const Z& m, const WeierstrassPoint& P, const Z& n, const WeierstrassPoint& Q);
 
 	WeierstrassPoint& operator*=(const Z& n) {
 		*this = *this * n;
@@ -243,12 +383,21 @@ public:
 	}
 
 	WeierstrassPoint psi() const {
-		return WeierstrassPoint(m_curve, -x, y * GF(y.get_p(), 0, 1));
+		return WeierstrassPoint(m_curve, -x, y * F(y.get_p(), 0, 1));
 	}
 
-	GF line(const WeierstrassPoint&, const WeierstrassPoint&) const;
-	GF miller(const WeierstrassPoint&, Z) const;
-	GF weil_pairing(const WeierstrassPoint&, const Z&) const;
+	F line(const WeierstrassPoint&, const WeierstrassPoint&) const;
+	F miller(const WeierstrassPoint&, Z) const;
+	F weil_pairing(const WeierstrassPoint&, const Z&) const;
+
+	/* The reduced Tate pairing f_n,P(Q)^((p² - 1)/n) for n dividing
+	   p² - 1, one Miller loop and an exponentiation instead of the two
+	   Miller loops of the Weil pairing.  Zero if this is not n-torsion,
+	   one if Q is the identity or hits a zero or pole of the Miller
+	   function, as for Q in <P>.  On the n-torsion of the curves of SIDH,
+	   which is all defined over Fp², it is alternating like the Weil
+	   pairing, so it has order n exactly for a basis.  */
+	F tate_pairing(const WeierstrassPoint&, const Z&) const;
 
 	friend std::ostream& operator<<(std::ostream& os, const WeierstrassPoint& point) {
 		if (point.identity)
@@ -257,89 +406,266 @@ public:
 			os << "(" << point.x << ", " << point.y << ") ∈ " << *point.m_curve;
 		return os;
 	}
-};
 
-class WeierstrassSmallIsogeny {
-	WeierstrassCurvePtr m_image;
-	const WeierstrassPoint m_generator;
-	const int m_degree;
+private:
+	/* If the sum of this and other needs a slope, stores it as the fraction
+	   num/den and returns true.  Otherwise stores the sum in res.  */
+	bool slope(const WeierstrassPoint& other, F& num, F& den, WeierstrassPoint& res) const {
+		const F &x1 = x, &y1 = y, &x2 = other.x, &y2 = other.y;
+		if (identity) {
+			res = other;
+			return false;
+		} else if (other.identity) {
+			res = *this;
+			return false;
+		} else if (x1 == x2) {
+			if (y1 == -y2) {
+				res = WeierstrassPoint(m_curve);
+				return false;
+			} else {
+				num = 3*x1.square() + m_curve->a;
+				den = 2*y1;
+				return true;
+			}
+		} else {
+			num = y2 - y1;
+			den = x2 - x1;
+			return true;
+		}
+	}
 
-	WeierstrassSmallIsogeny(const WeierstrassCurvePtr& image, const WeierstrassPoint& generator, int degree) :
-		m_image(image), m_generator(generator), m_degree(degree) {}
+	WeierstrassPoint add_with_slope(const WeierstrassPoint& other, const F& lambda) const {
+		F x3 = lambda.square() - x - other.x;
+		F y3 = lambda*(x - x3) - y;
+		return WeierstrassPoint(m_curve, std::move(x3), std::move(y3));
+	}
+
+	void line(const WeierstrassPoint&, const WeierstrassPoint&, F&, F&) const;
+	void miller(const WeierstrassPoint&, Z, F&, F&) const;
 
+	/* The steps of the Miller loop at this point: V ← 2V or V ← V + P,
+	   with the line through the summands divided by the vertical through
+	   the sum as num/den.  */
+	void miller_double(WeierstrassJacobianPoint<F>& V, F& num, F& den) const;
+	void miller_add(WeierstrassJacobianPoint<F>& V, const WeierstrassPoint& P, F& num, F& den) const;
+};
+
+/* Point in Jacobian coordinates (x : y : z), standing for the affine point
+   (x/z², y/z³), with z = 0 for the identity.  Doubling and addition need no
+   inversion, only the conversion back to a WeierstrassPoint does, so the
+   scalar multiplications work in these coordinates and normalize once at
+   the end.  The formulas are dbl-2007-bl, add-2007-bl, madd-2007-bl and
+   tpl-2007-bl of https://hyperelliptic.org/EFD/g1p/auto-shortw-jacobian.html
+   and for repeated doublings mdbl-2007-bl of the modified Jacobian
+   coordinates of https://hyperelliptic.org/EFD/g1p/auto-shortw-modified.html  */
+template<typename F>
+class WeierstrassJacobianPoint {
+	WeierstrassCurveHandle<F> m_curve;
+	F x, y, z;
 public:
-	friend class WeierstrassCurve;
+	friend class WeierstrassCurve<F>;
+	friend class WeierstrassPoint<F>;
+	friend class WeierstrassSmallIsogeny<F>;
 
-	const WeierstrassCurvePtr& image() const {
-		return m_image;
-	}
+	explicit WeierstrassJacobianPoint(const WeierstrassPoint<F>&);
 
-	const WeierstrassPoint& generator() const {
-		return m_generator;
+	WeierstrassCurveHandle<F> curve() const {
+		return m_curve;
 	}
 
-	Z degree() const {
-		return Z(m_degree);
+	bool is_identity() const {
+		return !z;
 	}
 
-	WeierstrassPoint operator()(const WeierstrassPoint& source) const {
-		if (source.is_identity())
-			return WeierstrassPoint(m_image);
+	WeierstrassJacobianPoint& double_inplace();
+	WeierstrassJacobianPoint& operator+=(const WeierstrassJacobianPoint&);
 
-		WeierstrassPoint from_kernel(m_generator);
-		GF x(source.x), y(source.y), xx(source.x);
+	/* 2^e·P by e doublings which carry a·z⁴ from one to the next */
+	WeierstrassJacobianPoint& double_times_inplace(int e);
 
-		for (int i = 0; i < m_degree-1; ++i) {
-			WeierstrassPoint sum = (source + from_kernel);
-			x += sum.x - from_kernel.x;
-			y += sum.y - from_kernel.y;
-			from_kernel += m_generator;
-		}
+	/* 3·P by a single formula instead of a doubling and an addition */
+	WeierstrassJacobianPoint& triple_inplace();
+	WeierstrassJacobianPoint& triple_times_inplace(int e);
+
+	/* Mixed addition of an affine point, cheaper than the general one */
+	WeierstrassJacobianPoint& operator+=(const WeierstrassPoint<F>&);
+
+	/* Adds P if condition holds, computing the sum either way so that the
+	   operations done do not depend on it */
+	void add_if(const WeierstrassPoint<F>& P, bool condition);
+
+	/* Multiplies by base^exp, see WeierstrassPoint::multiply_by_power.
+	   Bases 2 and 3 go to double_times_inplace and triple_times_inplace,
+	   others are done by double and add.  */
+	WeierstrassJacobianPoint& multiply_by_power_inplace(int base, int exp);
+
+	WeierstrassPoint<F> affine() const;
 
-		return WeierstrassPoint(m_image, x, y);
+	/* Converts the points in [first, last) to out, sharing one inversion
+	   among all of them */
+	static void affine_batch(const WeierstrassJacobianPoint *first, const WeierstrassJacobianPoint *last, WeierstrassPoint<F> *out);
+};
+
+/* Multiples of a point known in advance by the comb method of Lim and
+   Lee.  A scalar of up to bits bits is cut into teeth rows of spacing =
+   ⌈bits/teeth⌉ bits, and the table holds the 2^teeth sums of
+   2^(t·spacing)·base over the subsets of rows t.  A multiplication then
+   takes spacing doublings and as many mixed additions of table entries,
+   one per column of the rows.
+
+   The table can be serialized to skip building it, the object to read it
+   into is made by the constructor with the curve only.  */
+template<typename F>
+class WeierstrassFixedBase {
+	std::size_t m_bits, m_teeth, m_spacing;
+	std::vector<WeierstrassPoint<F>> m_table;
+public:
+	WeierstrassFixedBase() : m_bits(0), m_teeth(0), m_spacing(0) {}
+
+	WeierstrassFixedBase(const WeierstrassPoint<F>& base, std::size_t bits, std::size_t teeth = 6);
+
+	WeierstrassFixedBase(WeierstrassCurveHandle<F> curve, std::size_t bits, std::size_t teeth = 6) :
+		m_bits(bits), m_teeth(teeth), m_spacing((bits + teeth - 1) / teeth),
+		m_table(std::size_t(1) << teeth, WeierstrassPoint<F>(curve)) {}
+
+	const WeierstrassPoint<F>& base() const {
+		return m_table[1];
 	}
+
+	/* k·base + P, by the generic multiplication if k is negative or too
+	   long for the table.  Every column is added, the identity one by
+	   WeierstrassJacobianPoint::add_if, as k is a secret key.  */
+	WeierstrassPoint<F> multiply_add(const Z& k, const WeierstrassPoint<F>& P) const;
+
+	WeierstrassPoint<F> multiply(const Z& k) const {
+		return multiply_add(k, WeierstrassPoint<F>(base().curve()));
+	}
+
+	/* The entries but the identity, each in the format of
+	   WeierstrassPoint */
+	size_t size() const {
+		return (m_table.size() - 1) * m_table[0].size();
+	}
+
+	void serialize(unsigned char *) const;
+	bool unserialize(const unsigned char *);
+
+	/* Whether this is the table the constructor builds for base, as
+	   unserialize only checks that the entries lie on the curve.  Takes
+	   about as long as building the table.  */
+	bool is_table_of(const WeierstrassPoint<F>& base) const;
 };
 
-class WeierstrassIsogeny {
-	WeierstrassPoint m_generator;
-	int m_base, m_exp;
-	std::vector<WeierstrassSmallIsogeny> m_isogenies;
+/* An isogeny of degree 2, 3 or 4 by Vélu's formulas.  The kernel points
+   other than the identity are those of order two and pairs ±T of the
+   others, and for one representative T of each
+     v_T = 3x_T² + a,       u_T = 0      if T has order two,
+     v_T = 2·(3x_T² + a),   u_T = 4y_T²  otherwise,
+   that is T = G for degrees 2 and 3 and T = G, 2G for degree 4.  With
+   v = Σ v_T and w = Σ (u_T + x_T·v_T) the image is
+     y² = x³ + (a - 5v)·x + b - 7w
+   and a point maps to
+     x' = x + Σ (v_T/(x - x_T) + u_T/(x - x_T)²)
+     y' = y·(1 - Σ (v_T/(x - x_T)² + 2u_T/(x - x_T)³)).
+
+   The kernel is given in Jacobian coordinates with some z = ζ, which is
+   not normalized away.  Instead the image is taken projectively: the
+   isomorphic curve with the coefficients scaled by ζ⁴ and ζ⁶, to which
+   the point maps as (ζ²·x', ζ³·y').  The constants x_T·ζ², v_T·ζ⁴ and
+   u_T·ζ⁶ are polynomials in the coordinates of the kernel points, and so
+   is the image (X' : Y' : Z') of a point (X : Y : Z) with
+     X̂ = ζ²·X,  Ŷ = ζ³·Y,  D_T = X̂ - ζ²·x_T·Z²,  Π = ∏ D_T,
+     X' = X̂·Π² + Z⁴·Σ (Π/D_T)²·(ζ⁴·v_T·D_T + ζ⁶·u_T·Z²),
+     Y' = Ŷ·(Π³ - Z⁴·Σ (Π/D_T)³·(ζ⁴·v_T·D_T + 2ζ⁶·u_T·Z²)),
+     Z' = Z·Π,
+   so neither the construction nor the evaluation needs an inversion.
+   Points of the kernel have some D_T = 0 and map to the identity.  */
+template<typename F>
+class WeierstrassSmallIsogeny {
+	WeierstrassCurveHandle<F> m_image;
+	int m_degree, m_terms;
+	/* ζ², ζ³ and for each T the constants scaled as above */
+	F m_zz, m_zzz;
+	F m_x[2], m_v[2], m_u[2];
+
+	WeierstrassSmallIsogeny(WeierstrassCurveHandle<F> image, int degree) :
+		m_image(image), m_degree(degree), m_terms(0) {}
+
 public:
-	WeierstrassIsogeny() {}
+	friend class WeierstrassCurve<F>;
 
-	WeierstrassIsogeny(const WeierstrassPoint& generator, int base, int exp) :
-		m_generator(generator), m_base(base), m_exp(exp)
-	{
-		Z zbase(base);
-		WeierstrassCurveConstPtr curve = generator.curve();
-		WeierstrassPoint R(generator);
+	WeierstrassCurveHandle<F> image() const {
+		return m_image;
+	}
 
-		m_isogenies.reserve(exp);
+	Z degree() const {
+		return Z(m_degree);
+	}
 
-		for (int i = 0; i < exp; ++i) {
-			auto isogeny = curve->small_isogeny(zbase.pow(exp-i-1) * R, base);
-			m_isogenies.push_back(isogeny);
-			curve = isogeny.image();
-			if (i < exp-1)
-				R = isogeny(R);
+	WeierstrassPoint<F> operator()(const WeierstrassPoint<F>& source) const {
+		WeierstrassPoint<F> res(source);
+		evaluate(&res, &res + 1);
+		return res;
+	}
+
+	/* Maps the points in [first, last) in place */
+	void evaluate(WeierstrassJacobianPoint<F> *first, WeierstrassJacobianPoint<F> *last) const;
+
+	/* The affine results share one inversion */
+	void evaluate(WeierstrassPoint<F> *first, WeierstrassPoint<F> *last) const;
+};
+
+/* The intermediate curves live in one arena allocated up front, which the
+   copies of the isogeny share, so that the points of the walk can refer to
+   them by plain CurveHandles.
+
+   The streaming constructor maps the points in [first, last) along with
+   the kernel points of the walk and drops every step as soon as it is
+   done.  It keeps only the image, in an arena of two curves used in turn,
+   and cannot map any further points.
+
+   With a thread_pool::isogeny_pool() the evaluations of each step of the
+   walk are spread over its threads, and so are the points given to
+   evaluate, each thread taking its share through the whole chain.  */
+template<typename F>
+class WeierstrassIsogeny {
+	WeierstrassPoint<F> m_generator;
+	int m_base, m_exp;
+	std::vector<WeierstrassSmallIsogeny<F>> m_isogenies;
+	std::shared_ptr<std::vector<WeierstrassCurve<F>>> m_curves;
+	std::size_t m_image;
+
+	/* Never reallocated, the capacity is the length of the chain or two */
+	WeierstrassCurve<F>& next_curve(bool keep) {
+		if (keep || m_curves->size() < 2) {
+			m_curves->push_back(*m_generator.curve());
+			m_image = m_curves->size() - 1;
+		} else {
+			m_image ^= 1;
 		}
+		return (*m_curves)[m_image];
 	}
 
-	WeierstrassIsogeny(const WeierstrassPoint& generator, int base, int exp, const std::vector<int>& strategy) :
-		m_generator(generator), m_base(base), m_exp(exp)
-	{
-		WeierstrassCurveConstPtr curve = generator.curve();
-		std::vector<WeierstrassPoint> Rs{generator};
-		std::vector<int> hs{exp};
+	void walk(const std::vector<int>& strategy, WeierstrassPoint<F> *first, WeierstrassPoint<F> *last, bool keep) {
+		std::shared_ptr<thread_pool> pool = thread_pool::isogeny_pool();
+		std::vector<WeierstrassJacobianPoint<F>> Rs{WeierstrassJacobianPoint<F>(m_generator)}, images;
+		std::vector<int> hs{m_exp};
+
+		if (keep)
+			m_isogenies.reserve(m_exp);
+		m_curves->reserve(keep ? m_exp : 2);
+
+		images.reserve(last - first);
+		for (WeierstrassPoint<F> *P = first; P != last; ++P)
+			images.emplace_back(*P);
 
 		while (Rs.size()) {
-			WeierstrassPoint tmp = Rs.back();
+			WeierstrassJacobianPoint<F> tmp = Rs.back();
 			int h = hs.back();
 			int split = strategy[h];
 
 			while (h > 1) {
-				for (int i = 0; i < h - split; ++i)
-					tmp *= base;
+				tmp.multiply_by_power_inplace(m_base, h - split);
 				Rs.push_back(tmp);
 				hs.push_back(split);
 				h = split;
@@ -351,30 +677,82 @@ public:
 			h = hs.back();
 			hs.pop_back();
 
-			auto isogeny = tmp.curve()->small_isogeny(tmp, base);
-
-			for (size_t i = 0; i < Rs.size(); ++i) {
-				Rs[i] = isogeny(Rs[i]);
+			auto isogeny = tmp.curve()->small_isogeny(tmp, m_base, next_curve(keep));
+			std::size_t k = Rs.size(), n = k + images.size();
+
+			/* [0, n) indexes Rs followed by images */
+			auto evaluate = [&](std::size_t from, std::size_t to) {
+				if (from < k)
+					isogeny.evaluate(Rs.data() + from, Rs.data() + std::min(to, k));
+				if (to > k)
+					isogeny.evaluate(images.data() + std::max(from, k) - k, images.data() + to - k);
+			};
+
+			if (pool)
+				pool->run(n, evaluate);
+			else
+				evaluate(0, n);
+			for (size_t i = 0; i < hs.size(); ++i)
 				--hs[i];
-			}
 
+			if (keep)
+				m_isogenies.push_back(isogeny);
+		}
+
+		WeierstrassJacobianPoint<F>::affine_batch(images.data(), images.data() + images.size(), first);
+	}
+public:
+	WeierstrassIsogeny() : m_image(0) {}
+
+	WeierstrassIsogeny(const WeierstrassPoint<F>& generator, int base, int exp) :
+		m_generator(generator), m_base(base), m_exp(exp),
+		m_curves(std::make_shared<std::vector<WeierstrassCurve<F>>>()), m_image(0)
+	{
+		WeierstrassJacobianPoint<F> R(generator);
+
+		m_isogenies.reserve(exp);
+		m_curves->reserve(exp);
+
+		for (int i = 0; i < exp; ++i) {
+			WeierstrassJacobianPoint<F> kernel(R);
+			kernel.multiply_by_power_inplace(base, exp-i-1);
+
+			auto isogeny = R.curve()->small_isogeny(kernel, base, next_curve(true));
 			m_isogenies.push_back(isogeny);
+			if (i < exp-1)
+				isogeny.evaluate(&R, &R + 1);
 		}
 	}
 
+	WeierstrassIsogeny(const WeierstrassPoint<F>& generator, int base, int exp, const std::vector<int>& strategy) :
+		m_generator(generator), m_base(base), m_exp(exp),
+		m_curves(std::make_shared<std::vector<WeierstrassCurve<F>>>()), m_image(0)
+	{
+		walk(strategy, nullptr, nullptr, true);
+	}
+
+	WeierstrassIsogeny(const WeierstrassPoint<F>& generator, int base, int exp, const std::vector<int>& strategy,
+			   WeierstrassPoint<F> *first, WeierstrassPoint<F> *last) :
+		m_generator(generator), m_base(base), m_exp(exp),
+		m_curves(std::make_shared<std::vector<WeierstrassCurve<F>>>()), m_image(0)
+	{
+		walk(strategy, first, last, false);
+	}
+
 	Z degree() const {
 		return Z(m_base).pow(m_exp);
 	}
 
-	const WeierstrassCurvePtr& image() const {
-		return m_isogenies[m_exp-1].image();
+	/* Shares the ownership of the arena */
+	WeierstrassCurvePtr<F> image() const {
+		return WeierstrassCurvePtr<F>(m_curves, &(*m_curves)[m_image]);
 	}
 
-	const WeierstrassPoint& generator() const {
+	const WeierstrassPoint<F>& generator() const {
 		return m_generator;
 	}
 
-	const std::vector<WeierstrassSmallIsogeny>& isogenies() const {
+	const std::vector<WeierstrassSmallIsogeny<F>>& isogenies() const {
 		return m_isogenies;
 	}
 
@@ -384,15 +762,54 @@ public:
 		}
 	}
 
-	WeierstrassPoint operator()(const WeierstrassPoint& source) const {
-		WeierstrassPoint res(source);
-		for (auto isogeny : m_isogenies) {
-			res = isogeny(res);
-		}
+	WeierstrassPoint<F> operator()(const WeierstrassPoint<F>& source) const {
+		WeierstrassPoint<F> res(source);
+		evaluate(&res, &res + 1);
 		return res;
 	}
+
+	/* Maps the points in [first, last) in place, all of them through each
+	   step at once.  The affine variant goes through the whole chain in
+	   Jacobian coordinates, so that the points share a single inversion
+	   at the end instead of one per step.  */
+	void evaluate(WeierstrassJacobianPoint<F> *first, WeierstrassJacobianPoint<F> *last) const {
+		auto evaluate = [this, first](std::size_t from, std::size_t to) {
+			for (const auto& isogeny : m_isogenies)
+				isogeny.evaluate(first + from, first + to);
+		};
+
+		if (std::shared_ptr<thread_pool> pool = thread_pool::isogeny_pool())
+			pool->run(last - first, evaluate);
+		else
+			evaluate(0, last - first);
+	}
+
+	void evaluate(WeierstrassPoint<F> *first, WeierstrassPoint<F> *last) const {
+		std::vector<WeierstrassJacobianPoint<F>> R;
+
+		R.reserve(last - first);
+		for (WeierstrassPoint<F> *P = first; P != last; ++P)
+			R.emplace_back(*P);
+
+		evaluate(R.data(), R.data() + R.size());
+		WeierstrassJacobianPoint<F>::affine_batch(R.data(), R.data() + R.size(), first);
+	}
 };
 
+extern template class WeierstrassCurve<GF>;
+extern template class WeierstrassPoint<GF>;
+extern template class WeierstrassJacobianPoint<GF>;
+extern template class WeierstrassFixedBase<GF>;
+extern template class WeierstrassSmallIsogeny<GF>;
+extern template class WeierstrassIsogeny<GF>;
+
+extern template class WeierstrassCurve<GF751>;
+extern template class WeierstrassPoint<GF751>;
+extern template class WeierstrassJacobianPoint<GF751>;
+extern template class WeierstrassFixedBase<GF751>;
+extern template class WeierstrassSmallIsogeny<GF751>;
+extern template class WeierstrassIsogeny<GF751>;
+
 }
 
 #endif /* PQC_WEIERSTRASS_HPP */
@@ -2,13 +2,377 @@
 
 namespace pqc {
 
-MontgomeryPoint MontgomeryCurve::zero () {
-	GF z(A.get_p());
-	return MontgomeryPoint(*this, z, z);
+template<typename F>
+MontgomeryPoint<F> MontgomeryCurve<F>::zero() const
+{
+	const Z& p = A.get_p();
+	return MontgomeryPoint<F>(MontgomeryCurveHandle<F>(this), F(p, 1), F(p));
 }
 
-GF MontgomeryPoint::t1;
-GF MontgomeryPoint::t2;
-GF MontgomeryPoint::t3;
+template<typename F>
+WeierstrassCurvePtr<F> MontgomeryCurve<F>::to_weierstrass() const
+{
+	F AA = A.square(), BB = B.square();
+	F a = (3 - AA) / (3 * BB);
+	F b = (2 * AA - 9) * A / (27 * BB * B);
+	return std::make_shared<WeierstrassCurve<F>>(a, b);
+}
+
+template<typename F>
+MontgomeryCurvePtr<F> MontgomeryCurve<F>::from_weierstrass(const WeierstrassPoint<F>& T)
+{
+	if (T.is_identity() || T.y || !T.check())
+		return MontgomeryCurvePtr<F>();
+
+	const F& alpha = T.x;
+	F lambda = 3 * alpha.square() + T.curve()->a;
+	if (!lambda.is_square())
+		return MontgomeryCurvePtr<F>();
+	lambda.sqrt();
+
+	F B = lambda.inverse();
+	F A = 3 * alpha * B;
+	return std::make_shared<MontgomeryCurve<F>>(A, B);
+}
+
+template<typename F>
+MontgomeryPoint<F>::MontgomeryPoint(MontgomeryCurveHandle<F> curve, const WeierstrassPoint<F>& P) :
+	m_curve(curve), X(curve->A.get_p(), 1), Z(curve->A.get_p())
+{
+	if (!P.is_identity()) {
+		X = curve->B * P.x - curve->A / 3;
+		Z = F(curve->A.get_p(), 1);
+	}
+}
+
+template<typename F>
+WeierstrassPoint<F> MontgomeryPoint<F>::to_weierstrass(WeierstrassCurveHandle<F> curve) const
+{
+	if (is_identity())
+		return WeierstrassPoint<F>(curve);
+
+	return WeierstrassPoint<F>(curve, (x() + m_curve->A / 3) / m_curve->B);
+}
+
+template<typename F>
+void MontgomeryPoint<F>::double_add(MontgomeryPoint& P, MontgomeryPoint& Q, const MontgomeryPoint& diff)
+{
+	F s = P.X + P.Z, d = P.X - P.Z;
+
+	t1 = d * (Q.X + Q.Z);
+	t2 = s * (Q.X - Q.Z);
+	Q.X = diff.Z * (t1 + t2).square();
+	Q.Z = diff.X * (t1 - t2).square();
+
+	s.square_inplace();
+	d.square_inplace();
+	t3 = s - d;
+	P.X = s * d;
+	P.Z = t3 * (d + P.m_curve->A24 * t3);
+}
+
+template<typename F>
+MontgomeryPoint<F>& MontgomeryPoint<F>::operator*=(const pqc::Z& n)
+{
+	if (is_identity())
+		return *this;
+
+	if (n == 0) {
+		X = F(X.get_p(), 1);
+		Z = F(X.get_p());
+		return *this;
+	}
+
+	/* x(-nP) = x(nP) */
+	pqc::Z k = n < 0 ? pqc::Z(-n) : n;
+	MontgomeryPoint R[2] = { *this, *this };
+	R[1].double_inplace();
+
+	for (std::ptrdiff_t i = k.bit_length() - 2; i >= 0; --i) {
+		int bit = k.testbit(i);
+		double_add(R[bit], R[1-bit], *this);
+	}
+
+	*this = R[0];
+	return *this;
+}
+
+template<typename F>
+MontgomeryPoint<F> MontgomeryPoint<F>::three_point_ladder(const MontgomeryPoint& P, const MontgomeryPoint& Q,
+							 const MontgomeryPoint& PmQ, const pqc::Z& k)
+{
+	MontgomeryPoint R0(Q), R1(P), R2(PmQ);
+
+	for (std::size_t i = 0, bits = k.bit_length(); i < bits; ++i) {
+		if (k.testbit(i))
+			double_add(R0, R1, R2);
+		else
+			double_add(R0, R2, R1);
+	}
+
+	return R1;
+}
+
+template<typename F>
+thread_local F MontgomeryPoint<F>::t1;
+template<typename F>
+thread_local F MontgomeryPoint<F>::t2;
+template<typename F>
+thread_local F MontgomeryPoint<F>::t3;
+
+/* X₂ = C24·(X - Z)²·(X + Z)²
+   Z₂ = 4XZ·(C24·(X - Z)² + A24plus·4XZ),  4XZ = (X + Z)² - (X - Z)²
+   which is double_inplace multiplied through by C24.  */
+template<typename F>
+void MontgomeryIsogeny<F>::xDBL(MontgomeryPoint<F>& P, const F& A24plus, const F& C24)
+{
+	F s = (P.X + P.Z).square(), d = (P.X - P.Z).square();
+
+	P.Z = C24 * d;
+	P.X = P.Z * s;
+	s -= d;
+	P.Z += A24plus * s;
+	P.Z *= s;
+}
+
+/* X₃ = 2X·(T·(A24plus·(X + Z)² - A24minus·(X - Z)²) + D)²
+   Z₃ = 2Z·(T·(A24plus·(X + Z)² - A24minus·(X - Z)²) - D)²
+   with T = 4X² - (X + Z)² - (X - Z)² and
+   D = A24minus·(X - Z)⁴ - A24plus·(X + Z)⁴.  */
+template<typename F>
+void MontgomeryIsogeny<F>::xTPL(MontgomeryPoint<F>& P, const F& A24plus, const F& A24minus)
+{
+	F d = P.X - P.Z, s = P.X + P.Z;
+	F dd = d.square(), ss = s.square();
+	F x2 = s + d, z2 = s - d;
+	F t = x2.square() - ss - dd;
+	F u = A24plus * ss, v = A24minus * dd;
+
+	ss *= u;
+	dd *= v;
+	dd -= ss;
+	t *= u - v;
+
+	P.X = x2 * (dd + t).square();
+	P.Z = z2 * (dd - t).square();
+}
+
+template<typename F>
+void MontgomeryIsogeny<F>::xDBLe(MontgomeryPoint<F>& P, const F& A24plus, const F& C24, int e)
+{
+	for (int i = 0; i < e; ++i)
+		xDBL(P, A24plus, C24);
+}
+
+template<typename F>
+void MontgomeryIsogeny<F>::xTPLe(MontgomeryPoint<F>& P, const F& A24plus, const F& A24minus, int e)
+{
+	for (int i = 0; i < e; ++i)
+		xTPL(P, A24plus, A24minus);
+}
+
+/* Kernel (X₂ : Z₂) ≠ (0 : 1), image (A + 2C : 4C) = (Z₂² - X₂² : Z₂²) */
+template<typename F>
+void MontgomeryIsogeny<F>::get_2_isog(const MontgomeryPoint<F>& K, F& A24plus, F& C24)
+{
+	C24 = K.Z.square();
+	A24plus = C24 - K.X.square();
+}
+
+/* X' = X·((X₂ + Z₂)·(X - Z) + (X₂ - Z₂)·(X + Z))
+   Z' = Z·((X₂ + Z₂)·(X - Z) - (X₂ - Z₂)·(X + Z))  */
+template<typename F>
+void MontgomeryIsogeny<F>::eval_2_isog(const MontgomeryPoint<F>& K, MontgomeryPoint<F>& P)
+{
+	F t0 = (K.X + K.Z) * (P.X - P.Z);
+	F t1 = (K.X - K.Z) * (P.X + P.Z);
+
+	P.X *= t0 + t1;
+	P.Z *= t0 - t1;
+}
+
+/* Kernel (X₄ : Z₄) of order four with 2·(X₄ : Z₄) ≠ (0 : 1), image
+   (A + 2C : 4C) = (4X₄⁴ : 4Z₄⁴), and the coefficients
+   (4Z₄², X₄ - Z₄, X₄ + Z₄) for eval_4_isog.  */
+template<typename F>
+void MontgomeryIsogeny<F>::get_4_isog(const MontgomeryPoint<F>& K, F& A24plus, F& C24, F *coeff)
+{
+	coeff[1] = K.X - K.Z;
+	coeff[2] = K.X + K.Z;
+	coeff[0] = K.Z.square();
+	coeff[0] += coeff[0];
+	C24 = coeff[0].square();
+	coeff[0] += coeff[0];
+	A24plus = K.X.square();
+	A24plus += A24plus;
+	A24plus.square_inplace();
+}
+
+/* With s = (X + Z)·c₁ + (X - Z)·c₂, d = (X - Z)·c₂ - (X + Z)·c₁ and
+   t = c₀·(X + Z)·(X - Z)
+     X' = s²·(s² + t)
+     Z' = d²·(d² - t)  */
+template<typename F>
+void MontgomeryIsogeny<F>::eval_4_isog(const F *coeff, MontgomeryPoint<F>& P)
+{
+	F s = P.X + P.Z, d = P.X - P.Z;
+	F t = coeff[0] * s * d;
+
+	s *= coeff[1];
+	d *= coeff[2];
+	P.X = (s + d).square();
+	P.Z = (d - s).square();
+	P.X *= P.X + t;
+	P.Z *= P.Z - t;
+}
+
+/* Kernel (X₃ : Z₃) of order three, with s = (X₃ + Z₃)², d = (X₃ - Z₃)²
+   and t = 4X₃² - s - d the image is
+     A + 2C = (t + d)·(8X₃² + 2s - d)
+     A - 2C = (t + s)·(8X₃² - s + 2d)
+   and the coefficients for eval_3_isog are (X₃ - Z₃, X₃ + Z₃).  */
+template<typename F>
+void MontgomeryIsogeny<F>::get_3_isog(const MontgomeryPoint<F>& K, F& A24plus, F& A24minus, F *coeff)
+{
+	coeff[0] = K.X - K.Z;
+	coeff[1] = K.X + K.Z;
+
+	F d = coeff[0].square(), s = coeff[1].square();
+	F t = (coeff[0] + coeff[1]).square() - s - d;
+	F u = s + t, v = t + d;
+
+	A24minus = u * (2 * (v + d) + s);
+	A24plus = v * (2 * (u + s) + d);
+}
+
+/* X' = X·(c₀·(X + Z) + c₁·(X - Z))²
+   Z' = Z·(c₁·(X - Z) - c₀·(X + Z))²  */
+template<typename F>
+void MontgomeryIsogeny<F>::eval_3_isog(const F *coeff, MontgomeryPoint<F>& P)
+{
+	F s = coeff[0] * (P.X + P.Z), d = coeff[1] * (P.X - P.Z);
+
+	P.X *= (s + d).square();
+	P.Z *= (d - s).square();
+}
+
+/* The traversal of the strategy is the one of WeierstrassIsogeny, with
+   heights counted in steps of the chain.  */
+template<typename F>
+MontgomeryIsogeny<F>::MontgomeryIsogeny(const MontgomeryPoint<F>& generator, int base, int exp, const std::vector<int>& strategy,
+					 MontgomeryPoint<F> *first, MontgomeryPoint<F> *last) :
+	m_base(base), m_exp(exp)
+{
+	const MontgomeryCurve<F>& curve = *generator.curve();
+	const Z& p = curve.A.get_p();
+	F c0 = curve.A + 2, c1(p, 4), coeff[3];
+	MontgomeryPoint<F> K(generator);
+	int steps = exp;
+
+	if (base == 2) {
+		if (exp & 1) {
+			MontgomeryPoint<F> T(K);
+			xDBLe(T, c0, c1, exp - 1);
+			get_2_isog(T, c0, c1);
+			eval_2_isog(T, K);
+			for (MontgomeryPoint<F> *P = first; P != last; ++P)
+				eval_2_isog(T, *P);
+		}
+		steps = exp / 2;
+	} else {
+		c1 = curve.A - 2;
+	}
+
+	std::shared_ptr<thread_pool> pool = thread_pool::isogeny_pool();
+	std::vector<MontgomeryPoint<F>> Rs{K};
+	std::vector<int> hs{steps};
+
+	while (steps && Rs.size()) {
+		MontgomeryPoint<F> tmp = Rs.back();
+		int h = hs.back();
+		int split = strategy[h];
+
+		while (h > 1) {
+			if (base == 2)
+				xDBLe(tmp, c0, c1, 2 * (h - split));
+			else
+				xTPLe(tmp, c0, c1, h - split);
+			Rs.push_back(tmp);
+			hs.push_back(split);
+			h = split;
+			split = strategy[h];
+		}
+
+		tmp = Rs.back();
+		Rs.pop_back();
+		hs.pop_back();
+
+		if (base == 2)
+			get_4_isog(tmp, c0, c1, coeff);
+		else
+			get_3_isog(tmp, c0, c1, coeff);
+
+		/* [0, n) indexes Rs followed by [first, last) */
+		std::size_t k = Rs.size(), n = k + (last - first);
+		auto evaluate = [&](std::size_t from, std::size_t to) {
+			for (std::size_t i = from; i < to; ++i) {
+				MontgomeryPoint<F>& P = i < k ? Rs[i] : first[i - k];
+				if (base == 2)
+					eval_4_isog(coeff, P);
+				else
+					eval_3_isog(coeff, P);
+			}
+		};
+
+		if (pool)
+			pool->run(n, evaluate);
+		else
+			evaluate(0, n);
+
+		for (auto& h : hs)
+			--h;
+	}
+
+	/* (A : C) = (4·(A + 2C) - 2·4C : 4C) or (2·((A + 2C) + (A - 2C)) : (A + 2C) - (A - 2C)) */
+	if (base == 2) {
+		m_A = c0 + c0 - c1;
+		m_A += m_A;
+		m_C = c1;
+	} else {
+		m_A = c0 + c1;
+		m_A += m_A;
+		m_C = c0 - c1;
+	}
+
+	/* B = x³ + A·x² + x for the first point makes (x, 1) a point of the
+	   image, and so all of the points, being images of one group */
+	F A = m_A / m_C, B(p, 1);
+	if (first != last && !first->is_identity()) {
+		F x = first->x();
+		F rhs = ((x + A) * x + 1) * x;
+		if (rhs)
+			B = rhs;
+	}
+
+	m_image = std::make_shared<MontgomeryCurve<F>>(A, B);
+	for (MontgomeryPoint<F> *P = first; P != last; ++P)
+		P->m_curve = MontgomeryCurveHandle<F>(m_image);
+}
+
+template<typename F>
+F MontgomeryIsogeny<F>::j_invariant() const
+{
+	F AA = m_A.square(), CC = m_C.square();
+	F t = AA - 3 * CC;
+	return 256 * t.square() * t / (CC.square() * (AA - 4 * CC));
+}
+
+template class MontgomeryCurve<GF>;
+template class MontgomeryPoint<GF>;
+template class MontgomeryIsogeny<GF>;
+
+template class MontgomeryCurve<GF751>;
+template class MontgomeryPoint<GF751>;
+template class MontgomeryIsogeny<GF751>;
 
 }
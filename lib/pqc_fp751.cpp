@@ -0,0 +1,328 @@
+#include <pqc_fp751.hpp>
+
+namespace pqc {
+
+constexpr mp_limb_t P751::p[];
+constexpr mp_limb_t P751::r[];
+constexpr mp_limb_t P751::r2[];
+constexpr mp_limb_t P751::r3[];
+
+const Z& P751::modulus()
+{
+	static const Z modulus(
+		"0x6fe5d541f71c0e12909f97badc668562b5045cb25748084e9867d6ebe876da959b1a13f7cc76e3ec968549f878a8e"
+		"eafffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+	);
+	return modulus;
+}
+
+/* Montgomery reduction of the 2·limbs wide t (which is destroyed),
+   r = t·R⁻¹ mod p.  Requires t < p·R, which holds for products of two
+   reduced residues.  */
+template<typename Params>
+void Fp<Params>::redc(mp_limb_t *r, mp_limb_t *t)
+{
+	/* Each step clears the lowest limb, which then keeps the carry out of
+	   the row until all of them are added to the upper half at once.  */
+	for (std::size_t i = 0; i < limbs; ++i) {
+		mp_limb_t q = t[i] * Params::pinv;
+		t[i] = mpn_addmul_1(t + i, Params::p, limbs, q);
+	}
+
+	if (mpn_add_n(r, t + limbs, t, limbs) || mpn_cmp(r, Params::p, limbs) >= 0)
+		mpn_sub_n(r, r, Params::p, limbs);
+}
+
+template<typename Params>
+void Fp<Params>::mul(mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b)
+{
+	mp_limb_t t[2*limbs];
+
+	if (a == b)
+		mpn_sqr(t, a, limbs);
+	else
+		mpn_mul_n(t, a, b, limbs);
+
+	redc(r, t);
+}
+
+template<typename Params>
+void Fp<Params>::set_si(long x)
+{
+	if (!x) {
+		mpn_zero(v, limbs);
+		return;
+	}
+
+	mpn_copyi(v, Params::r, limbs);
+	mul_ui(x < 0 ? -static_cast<unsigned long>(x) : x);
+	if (x < 0)
+		negate();
+}
+
+/* Montgomery representation is linear, so multiplication by a small
+   integer needs just a one limb product and a remainder with a single
+   quotient limb.  */
+template<typename Params>
+Fp<Params>& Fp<Params>::mul_ui(unsigned long x)
+{
+	mp_limb_t t[limbs+1], q[2];
+
+	if (x == 1)
+		return *this;
+
+	t[limbs] = mpn_mul_1(t, v, limbs, x);
+	mpn_tdiv_qr(q, v, 0, t, limbs+1, Params::p, limbs);
+	return *this;
+}
+
+template<typename Params>
+void Fp<Params>::set_z(const Z& x)
+{
+	mp_limb_t t[limbs] = {};
+	Z reduced;
+	const Z *src = &x;
+
+	if (sgn(x) < 0 || ::mpz_cmp(x, modulus()) >= 0) {
+		::mpz_mod(reduced, x, modulus());
+		src = &reduced;
+	}
+
+	std::size_t n = ::mpz_size(*src);
+	mpn_copyi(t, ::mpz_limbs_read(*src), n);
+	mul(v, t, Params::r2);
+}
+
+template<typename Params>
+Z Fp<Params>::get_z() const
+{
+	mp_limb_t t[2*limbs] = {};
+	Z res;
+
+	mpn_copyi(t, v, limbs);
+	mp_limb_t *d = ::mpz_limbs_write(res, limbs);
+	redc(d, t);
+	::mpz_limbs_finish(res, limbs);
+
+	return res;
+}
+
+/* The inverse of the Montgomery residue x·R is computed by the extended
+   Euclidean algorithm on (x·R + p, p), whose cofactor of the first operand
+   is (x·R)⁻¹ = x⁻¹·R⁻¹ mod p.  Montgomery multiplication by R³ then brings
+   it back to x⁻¹·R.  The operands are destroyed by mpn_gcdext and need one
+   extra limb of space.  */
+template<typename Params>
+bool Fp<Params>::inverse_inplace()
+{
+	mp_limb_t u[limbs+1], w[limbs+1], g[limbs], s[limbs+1] = {};
+	mp_size_t sn;
+
+	if (is_zero())
+		return false;
+
+	mpn_add_n(u, v, Params::p, limbs);
+	mpn_copyi(w, Params::p, limbs);
+
+	if (mpn_gcdext(g, s, &sn, u, limbs, w, limbs) != 1 || g[0] != 1)
+		return false;
+
+	if (sn < 0) {
+		mpn_sub(s, Params::p, limbs, s, -sn);
+	}
+
+	mul(v, s, Params::r3);
+	return true;
+}
+
+template<typename Params>
+Fp<Params> Fp<Params>::pow(const Z& exp) const
+{
+	if (sgn(exp) == 0) {
+		Fp res;
+		mpn_copyi(res.v, Params::r, limbs);
+		return res;
+	}
+
+	return FixedExponent(exp).pow(*this);
+}
+
+/* Legendre symbol by mpz_jacobi, which is much cheaper than an
+   exponentiation by (p-1)/2 even with the conversion out of Montgomery
+   representation.  */
+template<typename Params>
+bool Fp<Params>::is_square() const
+{
+	return ::mpz_jacobi(get_z(), modulus()) == 1;
+}
+
+/* The schedule for the exponent is computed only once.  */
+template<typename Params>
+Fp<Params>& Fp<Params>::sqrt()
+{
+	static const FixedExponent exp((modulus() + 1) >> 2);
+	*this = exp.pow(*this);
+	return *this;
+}
+
+template<typename Params>
+void Fp<Params>::serialize(unsigned char *out) const
+{
+	mp_limb_t t[2*limbs] = {}, x[limbs];
+
+	mpn_copyi(t, v, limbs);
+	redc(x, t);
+
+	for (std::size_t i = 0; i < bytes; ++i)
+		out[i] = x[i / 8] >> (8 * (i % 8));
+}
+
+template<typename Params>
+void Fp<Params>::unserialize(const unsigned char *in)
+{
+	mp_limb_t t[limbs] = {};
+
+	for (std::size_t i = 0; i < bytes; ++i)
+		t[i / 8] |= static_cast<mp_limb_t>(in[i]) << (8 * (i % 8));
+
+	/* the serialized width is at most one bit more than p, so t < 2p and
+	   the product with R² stays below p·R, as required by the reduction */
+	mul(v, t, Params::r2);
+}
+
+/* Same Karatsuba-like formula as GF::operator*=, but with lazy reduction:
+   the sums are not reduced and the three products are combined at double
+   width, so that each coefficient needs only one Montgomery reduction.
+   With a, b, c, d in [0, p)
+     (a + p - b)·(c + d) - ad + bc = ac - bd + p·(c + d),
+   which lies in [0, 3p²), and ad + bc lies in [0, 2p²).  The intermediate
+   value after subtracting ad is ac + (p - b)·(c + d), which is never
+   negative either.  3p < R, so both stay below p·R.  */
+template<typename Params>
+void Fp2<Params>::mul(Fp2& res, const Fp2& x, const Fp2& y)
+{
+	const std::size_t n = base_field::limbs;
+	mp_limb_t s1[n], s2[n], t1[2*n], t2[2*n], t3[2*n];
+
+	mpn_add_n(s1, x.a.v, Params::p, n);
+	mpn_sub_n(s1, s1, x.b.v, n);
+	mpn_add_n(s2, y.a.v, y.b.v, n);
+
+	mpn_mul_n(t3, s1, s2, n);
+	mpn_mul_n(t1, x.a.v, y.b.v, n);
+	mpn_mul_n(t2, x.b.v, y.a.v, n);
+
+	mpn_sub_n(t3, t3, t1, 2*n);
+	mpn_add_n(t3, t3, t2, 2*n);
+	mpn_add_n(t1, t1, t2, 2*n);
+
+	base_field::redc(res.a.v, t3);
+	base_field::redc(res.b.v, t1);
+}
+
+/* (a + bi)² = (a + b)·(a - b) + 2ab·i, computed as
+     (a + b)·(a + p - b) = a² - b² + p·(a + b)  ∈ [0, 4p²),
+     2a·b                                      ∈ [0, 2p²),
+   again with unreduced sums and one reduction per coefficient.  */
+template<typename Params>
+void Fp2<Params>::sqr(Fp2& res, const Fp2& x)
+{
+	const std::size_t n = base_field::limbs;
+	mp_limb_t s1[n], s2[n], t1[2*n], t2[2*n];
+
+	mpn_add_n(s1, x.a.v, x.b.v, n);
+	mpn_add_n(s2, x.a.v, Params::p, n);
+	mpn_sub_n(s2, s2, x.b.v, n);
+	mpn_mul_n(t1, s1, s2, n);
+
+	mpn_lshift(s1, x.a.v, n, 1);
+	mpn_mul_n(t2, s1, x.b.v, n);
+
+	base_field::redc(res.a.v, t1);
+	base_field::redc(res.b.v, t2);
+}
+
+/* See GF::is_square, the norm is a square exactly if the element is.  */
+template<typename Params>
+bool Fp2<Params>::is_square() const
+{
+	return (a.square() + b.square()).is_square();
+}
+
+/* See GF::sqrt for the derivation.  */
+template<typename Params>
+Fp2<Params>& Fp2<Params>::sqrt()
+{
+	static const base_field half = [] {
+		base_field res(2);
+		res.inverse_inplace();
+		return res;
+	}();
+
+	if (b.is_zero()) {
+		if (a.is_square()) {
+			a.sqrt();
+		} else {
+			b = -a;
+			b.sqrt();
+			a = base_field();
+		}
+		return *this;
+	}
+
+	base_field n = a.square() + b.square();
+	n.sqrt();
+
+	base_field t = (a + n) * half;
+	base_field s = t;
+	s.sqrt();
+
+	base_field d = s + s;
+	d.inverse_inplace();
+	d *= b;
+
+	if (s.square() == t) {
+		a = s;
+		b = d;
+	} else {
+		a = d;
+		b = s;
+	}
+	return *this;
+}
+
+template<typename Params>
+void Fp2<Params>::serialize(unsigned char *buffer) const
+{
+	a.serialize(buffer);
+	b.serialize(buffer + base_field::bytes);
+}
+
+template<typename Params>
+bool Fp2<Params>::unserialize(const unsigned char *buffer)
+{
+	a.unserialize(buffer);
+	b.unserialize(buffer + base_field::bytes);
+	return true;
+}
+
+template<typename Params>
+std::string Fp2<Params>::serialize() const
+{
+	std::string result(size(), 0);
+	serialize(reinterpret_cast<unsigned char *>(&result[0]));
+	return result;
+}
+
+template<typename Params>
+bool Fp2<Params>::unserialize(const std::string& raw)
+{
+	if (raw.size() != size())
+		return false;
+	return unserialize(reinterpret_cast<const unsigned char *>(raw.data()));
+}
+
+template class Fp<P751>;
+template class Fp2<P751>;
+
+}
@@ -1,52 +1,213 @@
+#include <cstring>
 #include <pqc_gf.hpp>
 
 namespace pqc {
 
-std::string Z::serialize(size_t len) const
+/* mpz_export and mpz_import with single byte words in little-endian order
+   copy the limbs in one pass, the rest of the buffer is zero padding.
+   Negative numbers and those longer than the buffer are first replaced by
+   their residue modulo 2^(8·len), which is non-negative and fits, so that
+   negative numbers come out in two's complement.  */
+void Z::serialize(unsigned char *buffer, size_t len) const
 {
-	unsigned char *buffer;
-	std::string result;
+	size_t count = 0;
 
-	result.resize(len);
-	buffer = reinterpret_cast<unsigned char *>(&result[0]);
+	if (len == 0)
+		return;
 
-	for (size_t i = 0; i < len; ++i) {
-		buffer[i] = Z((*this >> (i*8)) & 0xff).get_si();
+	if (sgn(*this) < 0 || bit_length() > 8*len) {
+		Z low;
+		::mpz_fdiv_r_2exp(low, *this, 8*len);
+		low.serialize(buffer, len);
+		return;
 	}
 
+	if (sgn(*this) != 0)
+		::mpz_export(buffer, &count, -1, 1, 0, 0, *this);
+	std::memset(buffer + count, 0, len - count);
+}
+
+void Z::unserialize(const unsigned char *buffer, size_t len)
+{
+	::mpz_import(*this, len, -1, 1, 0, 0, buffer);
+}
+
+std::string Z::serialize(size_t len) const
+{
+	std::string result(len, 0);
+	serialize(reinterpret_cast<unsigned char *>(&result[0]), len);
 	return result;
 }
 
 void Z::unserialize(const std::string& raw)
 {
-	const unsigned char *buffer;
-	*this = 0;
+	unserialize(reinterpret_cast<const unsigned char *>(raw.data()), raw.size());
+}
 
-	buffer = reinterpret_cast<const unsigned char *>(&raw[0]);
-	for (ssize_t i = raw.size()-1; i >= 0; --i) {
-		*this <<= 8;
-		*this |= buffer[i];
-	}
+void GF::serialize(unsigned char *buffer) const
+{
+	size_t half = size() / 2;
+	a.serialize(buffer, half);
+	b.serialize(buffer + half, half);
 }
 
-std::string GF::serialize() const
+bool GF::unserialize(const unsigned char *buffer)
 {
 	size_t half = size() / 2;
-	return a.serialize(half) + b.serialize(half);
+	a.unserialize(buffer, half);
+	reduce(a);
+	b.unserialize(buffer + half, half);
+	reduce(b);
+	return true;
+}
+
+std::string GF::serialize() const
+{
+	std::string result(size(), 0);
+	serialize(reinterpret_cast<unsigned char *>(&result[0]));
+	return result;
 }
 
 bool GF::unserialize(const std::string& raw)
 {
-	size_t half = size() / 2;
-	if (raw.size() != 2*half)
+	if (raw.size() != size())
+		return false;
+	return unserialize(reinterpret_cast<const unsigned char *>(raw.data()));
+}
+
+FixedExponent::FixedExponent(const Z& exp) : max_power(0)
+{
+	std::ptrdiff_t bits = exp.bit_length();
+	unsigned window = bits <= 64 ? 3 : bits <= 256 ? 4 : bits <= 1024 ? 5 : 6;
+	unsigned squarings = 0;
+
+	for (std::ptrdiff_t i = bits - 1; i >= 0; ) {
+		if (!exp.testbit(i)) {
+			++squarings;
+			--i;
+			continue;
+		}
+
+		/* the longest window starting at i and ending with a one bit */
+		std::ptrdiff_t j = std::max<std::ptrdiff_t>(i - window + 1, 0);
+		while (!exp.testbit(j))
+			++j;
+
+		unsigned u = 0;
+		for (std::ptrdiff_t k = i; k >= j; --k)
+			u = (u << 1) | exp.testbit(k);
+
+		squarings += i - j + 1;
+		steps.push_back(step { steps.empty() ? 0 : squarings, static_cast<int>(u >> 1) });
+		max_power = std::max(max_power, u >> 1);
+		squarings = 0;
+		i = j - 1;
+	}
+
+	if (squarings)
+		steps.push_back(step { squarings, -1 });
+}
+
+std::list<SpecialModulus> SpecialModulus::registered;
+std::atomic<const SpecialModulus *> SpecialModulus::head(nullptr);
+std::mutex SpecialModulus::registered_mutex;
+
+const SpecialModulus *SpecialModulus::add(const Z& p)
+{
+	std::lock_guard<std::mutex> lock(registered_mutex);
+
+	const SpecialModulus *res = find(p);
+	if (res)
+		return res;
+
+	Z n = p + 1;
+	std::size_t w = ::mpz_scan1(n, 0) / GMP_NUMB_BITS;
+
+	/* without a whole limb of the power of two the divisor is as long as
+	   p and there is nothing to gain */
+	if (sgn(p) <= 0 || w == 0 || ::mpz_size(p) > max_limbs)
+		return nullptr;
+
+	registered.push_back(SpecialModulus(p, w));
+	registered.back().next = head.load(std::memory_order_relaxed);
+	head.store(&registered.back(), std::memory_order_release);
+	return &registered.back();
+}
+
+const SpecialModulus *SpecialModulus::find(const Z& p)
+{
+	std::size_t size = ::mpz_size(p);
+
+	for (const SpecialModulus *m = head.load(std::memory_order_acquire); m; m = m->next)
+		if (::mpz_size(m->p) == size && m->p == p)
+			return m;
+
+	return nullptr;
+}
+
+bool SpecialModulus::reduce(Z& x) const
+{
+	std::size_t xn = ::mpz_size(x), pn = ::mpz_size(p), cn = ::mpz_size(c), mun = ::mpz_size(mu);
+
+	if (xn > 2 * pn) {
+		::mpz_mod(x, x, p);
 		return false;
-	a.unserialize(raw.substr(0, half));
-	b.unserialize(raw.substr(half));
+	}
+
+	bool negative = sgn(x) < 0;
+
+	if (xn >= pn) {
+		mp_limb_t q[2 * max_limbs + 2], qp[2 * max_limbs + 2], r[max_limbs + 1];
+		const mp_limb_t *xp = ::mpz_limbs_read(x), *pp = ::mpz_limbs_read(p);
+
+		/* q = x / 2^(64(pn - 1)) · μ / 2^(64(pn + 1)) */
+		std::size_t hn = xn - (pn - 1);
+		mpn_mul(q, ::mpz_limbs_read(mu), mun, xp + pn - 1, hn);
+		const mp_limb_t *qh = q + pn + 1;
+		std::size_t qn = mun + hn - (pn + 1);
+		while (qn > 0 && qh[qn - 1] == 0)
+			--qn;
+
+		/* the lower pn + 1 limbs of q·c'·2^(64w) - q */
+		std::fill(qp, qp + pn + 1, 0);
+		if (qn >= cn)
+			mpn_mul(qp + w, qh, qn, ::mpz_limbs_read(c), cn);
+		else if (qn > 0)
+			mpn_mul(qp + w, ::mpz_limbs_read(c), cn, qh, qn);
+		if (qn > 0)
+			mpn_sub(qp, qp, pn + 1, qh, std::min(qn, pn + 1));
+
+		if (xn > pn) {
+			mpn_sub_n(r, xp, qp, pn + 1);
+		} else {
+			r[pn] = 0;
+			r[pn] -= mpn_sub_n(r, xp, qp, pn);
+		}
+
+		for (int i = 0; i < 2 && (r[pn] || mpn_cmp(r, pp, pn) >= 0); ++i)
+			r[pn] -= mpn_sub_n(r, r, pp, pn);
+
+		std::size_t rn = pn;
+		while (rn > 0 && r[rn - 1] == 0)
+			--rn;
+		if (rn) {
+			mpn_copyi(::mpz_limbs_write(x, rn), r, rn);
+			::mpz_limbs_finish(x, rn);
+		} else {
+			x = 0;
+		}
+	} else if (negative) {
+		::mpz_neg(x, x);
+	}
+
+	if (negative && sgn(x) != 0)
+		::mpz_sub(x, p, x);
+
 	return true;
 }
 
-Z GF::t1;
-Z GF::t2;
-Z GF::t3;
+thread_local Z GF::t1;
+thread_local Z GF::t2;
+thread_local Z GF::t3;
 
 }
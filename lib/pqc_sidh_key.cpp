@@ -45,61 +45,69 @@ void sidh_key::generate()
 	generate_hash_seed();
 }
 
+/* The basic key is written directly into the result, which is allocated
+   once with room for the hash seed.  */
 std::string sidh_key::export_private() const
 {
-	std::string basic(sidh_key_basic::export_private());
+	std::string result;
 
-	if (!basic.size())
-		return basic;
-	else
-		return basic + hash_seed_;
+	result.reserve(private_size() + hash_seed_.size());
+	result.resize(private_size());
+	if (!write_private(reinterpret_cast<unsigned char *>(&result[0])))
+		return std::string();
+
+	return result += hash_seed_;
 }
 
 std::string sidh_key::export_public() const
 {
-	std::string basic(sidh_key_basic::export_public());
+	std::string result;
+
+	result.reserve(public_size() + hash_seed_.size());
+	result.resize(public_size());
+	if (!write_public(reinterpret_cast<unsigned char *>(&result[0])))
+		return std::string();
 
-	if (!basic.size())
-		return basic;
-	else
-		return basic + hash_seed_;
+	return result += hash_seed_;
 }
 
 std::string sidh_key::export_both() const
 {
-	std::string basic(sidh_key_basic::export_both());
+	if (!has_private_ || !has_public_)
+		return std::string();
+
+	std::string result;
 
-	if (!basic.size())
-		return basic;
-	else
-		return basic + hash_seed_;
+	result.reserve(private_size() + public_size() + hash_seed_.size());
+	result.resize(private_size() + public_size());
+	unsigned char *output = reinterpret_cast<unsigned char *>(&result[0]);
+	write_private(output);
+	write_public(output + private_size());
+
+	return result += hash_seed_;
 }
 
 bool sidh_key::import_private(const std::string& input)
 {
-	if (input.size() <= hash_seed_size)
+	if (input.size() != private_size() + hash_seed_size)
 		return false;
 
-	size_t basic_size = input.size() - hash_seed_size;
-
-	if (!sidh_key_basic::import_private(input.substr(0, basic_size)))
+	if (!read_private(reinterpret_cast<const unsigned char *>(input.data())))
 		return false;
 
-	hash_seed_ = input.substr(basic_size);
+	hash_seed_.assign(input, private_size(), hash_seed_size);
 	return true;
 }
 
 bool sidh_key::import_public(const std::string& input)
 {
-	if (input.size() <= hash_seed_size)
+	if (input.size() != public_size() + hash_seed_size)
 		return false;
 
-	size_t basic_size = input.size() - hash_seed_size;
-
-	if (!sidh_key_basic::import_public(input.substr(0, basic_size)))
+	if (!read_public(reinterpret_cast<const unsigned char *>(input.data())))
 		return false;
 
-	hash_seed_ = input.substr(basic_size);
+	hash_seed_.assign(input, public_size(), hash_seed_size);
 	return true;
 }
 
@@ -6,11 +6,12 @@ namespace pqc
 
 sidh_key_basic::sidh_key_basic(const sidh_params& params) :
 	asymmetric_key(),
+	engine_(engine::MONTGOMERY),
 	has_isogeny_(false),
 	params_(params),
-	curve_(std::make_shared<WeierstrassCurve>(params.prime)),
-	P_image_(curve_),
-	Q_image_(curve_)
+	curve_(std::make_shared<WeierstrassCurve<field>>(params.prime)),
+	P_image_(WeierstrassCurveHandle<field>(curve_)),
+	Q_image_(WeierstrassCurveHandle<field>(curve_))
 {
 }
 
@@ -48,8 +49,8 @@ bool sidh_key_basic::ensure_has_isogeny()
 	if (!has_private_)
 		return false;
 
-	WeierstrassPoint generator = m_*get_params().P + n_*get_params().Q;
-	isogeny_ = WeierstrassIsogeny(generator, get_params().l, get_params().e, get_params().strategy);
+	WeierstrassPoint<field> generator = fixed_base_generator(*sidh_params::precomputed());
+	isogeny_ = WeierstrassIsogeny<field>(generator, get_params().l, get_params().e, get_params().strategy);
 
 	has_isogeny_ = true;
 
@@ -64,16 +65,19 @@ std::string sidh_key_basic::compute_shared_secret(const sidh_key_basic& public_k
 	if (get_params().s == public_key.get_params().s)
 		return std::string();
 
+	if (engine_ == engine::MONTGOMERY)
+		return compute_shared_secret_montgomery(public_key);
+
 	const Z& m = get_m();
 	const Z& n = get_n();
 	int l = get_params().l;
 	int e = get_params().e;
-	const WeierstrassPoint& P_image = public_key.get_P_image();
-	const WeierstrassPoint& Q_image = public_key.get_Q_image();
+	const WeierstrassPoint<field>& P_image = public_key.get_P_image();
+	const WeierstrassPoint<field>& Q_image = public_key.get_Q_image();
 
-	WeierstrassPoint generator = m*P_image + n*Q_image;
+	WeierstrassPoint<field> generator = WeierstrassPoint<field>::linear_combination(m, P_image, n, Q_image);
 
-	return WeierstrassIsogeny(generator, l, e, get_params().strategy).image()->j_invariant().serialize();
+	return WeierstrassIsogeny<field>(generator, l, e, get_params().strategy, nullptr, nullptr).image()->j_invariant().serialize();
 }
 
 bool sidh_key_basic::generate_public()
@@ -81,18 +85,138 @@ bool sidh_key_basic::generate_public()
 	if (has_public_)
 		return true;
 
-	if (!ensure_has_isogeny())
+	if (engine_ == engine::MONTGOMERY)
+		return generate_public_montgomery();
+
+	if (!has_private_)
 		return false;
 
-	curve_ = isogeny_.image();
-	P_image_ = isogeny_(get_params().P_peer);
-	Q_image_ = isogeny_(get_params().Q_peer);
+	/* the steps are not kept, see get_isogeny */
+	const sidh_params& params = get_params();
+	WeierstrassPoint<field> generator = fixed_base_generator(*sidh_params::precomputed());
+	WeierstrassPoint<field> images[] = { params.P_peer, params.Q_peer };
+	WeierstrassIsogeny<field> isogeny(generator, params.l, params.e, params.strategy, images, images + 2);
+
+	curve_ = isogeny.image();
+	P_image_ = images[0];
+	Q_image_ = images[1];
 
 	has_public_ = true;
 
 	return true;
 }
 
+/* The Montgomery engine maps P_peer, Q_peer and their difference x-only,
+   and recovers the signs of the y coordinates in the Weierstrass model of
+   the image from the difference, which is all that the peer needs: a sign
+   change of both points does not change the kernels computed from them.  */
+bool sidh_key_basic::generate_public_montgomery()
+{
+	if (!has_private_)
+		return false;
+
+	const sidh_params& params = get_params();
+	std::shared_ptr<const sidh_params::precomputation> tables = sidh_params::precomputed();
+
+	/* see montgomery_model */
+	MontgomeryCurveHandle<field> model(tables->model_Pa);
+	if (params.s == sidh_params::side::A && m_.testbit(0) && !n_.testbit(0))
+		model = MontgomeryCurveHandle<field>(tables->model_Qa);
+
+	MontgomeryPoint<field> generator(model, fixed_base_generator(*tables));
+	MontgomeryPoint<field> images[] = {
+		MontgomeryPoint<field>(model, params.P_peer),
+		MontgomeryPoint<field>(model, params.Q_peer),
+		MontgomeryPoint<field>(model, params.P_peer - params.Q_peer)
+	};
+
+	MontgomeryIsogeny<field> isogeny(generator, params.l, params.e, params.montgomery_strategy, images, images + 3);
+
+	curve_ = isogeny.image()->to_weierstrass();
+	P_image_ = images[0].to_weierstrass(WeierstrassCurveHandle<field>(curve_));
+	Q_image_ = images[1].to_weierstrass(WeierstrassCurveHandle<field>(curve_));
+	if (MontgomeryPoint<field>(MontgomeryCurveHandle<field>(isogeny.image()), P_image_ - Q_image_) != images[2])
+		Q_image_ = -Q_image_;
+
+	has_public_ = true;
+
+	return true;
+}
+
+std::string sidh_key_basic::compute_shared_secret_montgomery(const sidh_key_basic& public_key) const
+{
+	const sidh_params& params = get_params();
+	const WeierstrassPoint<field>& P_image = public_key.get_P_image();
+	const WeierstrassPoint<field>& Q_image = public_key.get_Q_image();
+	MontgomeryCurvePtr<field> model;
+
+	/* only the images of the 2-power torsion basis tell which point of
+	   order two the kernel generator lies above, for the 3-isogenies any
+	   of them will do */
+	if (params.s == sidh_params::side::A)
+		model = montgomery_model(P_image, Q_image);
+	else
+		model = montgomery_model(public_key.get_curve_image());
+	if (!model)
+		return std::string();
+
+	MontgomeryPoint<field> generator = kernel_generator(MontgomeryCurveHandle<field>(model), P_image, Q_image);
+	return MontgomeryIsogeny<field>(generator, params.l, params.e, params.montgomery_strategy).j_invariant().serialize();
+}
+
+/* The kernel generator m·P + n·Q for the basis of the own side, by the
+   comb tables of its points.  */
+WeierstrassPoint<sidh_key_basic::field> sidh_key_basic::fixed_base_generator(const sidh_params::precomputation& tables) const
+{
+	bool A = get_params().s == sidh_params::side::A;
+	const WeierstrassFixedBase<field>& P = A ? tables.Pa : tables.Pb;
+	const WeierstrassFixedBase<field>& Q = A ? tables.Qa : tables.Qb;
+
+	if (m_ == 1)
+		return Q.multiply_add(n_, P.base());
+	else if (n_ == 1)
+		return P.multiply_add(m_, Q.base());
+	return WeierstrassPoint<field>::linear_combination(m_, P.base(), n_, Q.base());
+}
+
+/* The kernel generator x(m·P + n·Q) by the three-point ladder, one of m
+   and n being 1 for the keys generate_private and read_private make.  As
+   x(Q - P) = x(P - Q), the ladder works for both of the cases.  */
+MontgomeryPoint<sidh_key_basic::field> sidh_key_basic::kernel_generator(MontgomeryCurveHandle<field> model, const WeierstrassPoint<field>& P, const WeierstrassPoint<field>& Q) const
+{
+	MontgomeryPoint<field> xP(model, P), xQ(model, Q), xPmQ(model, P - Q);
+
+	if (m_ == 1)
+		return MontgomeryPoint<field>::three_point_ladder(xP, xQ, xPmQ, n_);
+	else if (n_ == 1)
+		return MontgomeryPoint<field>::three_point_ladder(xQ, xP, xPmQ, m_);
+	return MontgomeryPoint<field>(model, WeierstrassPoint<field>::linear_combination(m_, P, n_, Q));
+}
+
+/* A Montgomery model of the curve with the 2^ea-torsion basis P, Q, in
+   which (0, 0) is the point of order two below P, or below Q if the kernel
+   generator m·P + n·Q of side A lies above that one, which happens
+   exactly if m is odd and n is even.  That keeps (0, 0) out of the kernels
+   of the 4-isogenies.  */
+MontgomeryCurvePtr<sidh_key_basic::field> sidh_key_basic::montgomery_model(const WeierstrassPoint<field>& P, const WeierstrassPoint<field>& Q) const
+{
+	sidh_params A(sidh_params::side::A);
+
+	if (get_params().s == A.s && m_.testbit(0) && !n_.testbit(0))
+		return MontgomeryCurve<field>::from_weierstrass(Q * A.lem1);
+	return MontgomeryCurve<field>::from_weierstrass(P * A.lem1);
+}
+
+/* A Montgomery model of a curve given without its 2^ea-torsion basis, from
+   a random point of order two.  Every such point is 2^(ea-1) times a
+   rational point, so 3α² + a is a square for all of them.  */
+MontgomeryCurvePtr<sidh_key_basic::field> sidh_key_basic::montgomery_model(const WeierstrassCurveConstPtr<field>& curve) const
+{
+	sidh_params A(sidh_params::side::A), B(sidh_params::side::B);
+
+	return MontgomeryCurve<field>::from_weierstrass(curve->torsion_point(B.le * A.lem1, 1));
+}
+
 void sidh_key_basic::generate()
 {
 	has_private_ = false;
@@ -103,26 +227,65 @@ void sidh_key_basic::generate()
 	generate_public();
 }
 
-std::string sidh_key_basic::export_private() const
+size_t sidh_key_basic::private_size() const
+{
+	return get_params().le.size() + 1;
+}
+
+size_t sidh_key_basic::public_size() const
+{
+	return curve_->size() + 2*P_image_.size();
+}
+
+bool sidh_key_basic::write_private(unsigned char *output) const
 {
 	if (!has_private_)
-		return std::string();
+		return false;
 
 	size_t size = get_params().le.size();
-	if (m_ == 1)
-		return ((char) 0) + n_.serialize(size);
-	else
-		return ((char) 1) + m_.serialize(size);
+	if (m_ == 1) {
+		output[0] = 0;
+		n_.serialize(output + 1, size);
+	} else {
+		output[0] = 1;
+		m_.serialize(output + 1, size);
+	}
+
+	return true;
 }
 
-std::string sidh_key_basic::export_public() const
+bool sidh_key_basic::write_public(unsigned char *output) const
 {
 	if (!has_public_)
+		return false;
+
+	size_t curve_size = curve_->size(), point_size = P_image_.size();
+
+	curve_->serialize(output);
+	P_image_.serialize(output + curve_size);
+	Q_image_.serialize(output + curve_size + point_size);
+
+	return true;
+}
+
+std::string sidh_key_basic::export_private() const
+{
+	std::string result(private_size(), 0);
+
+	if (!write_private(reinterpret_cast<unsigned char *>(&result[0])))
 		return std::string();
 
-	const WeierstrassCurvePtr& curve = has_isogeny_ ? isogeny_.image() : curve_;
+	return result;
+}
+
+std::string sidh_key_basic::export_public() const
+{
+	std::string result(public_size(), 0);
+
+	if (!write_public(reinterpret_cast<unsigned char *>(&result[0])))
+		return std::string();
 
-	return curve->serialize() + P_image_.serialize() + Q_image_.serialize();
+	return result;
 }
 
 std::string sidh_key_basic::export_both() const
@@ -130,28 +293,38 @@ std::string sidh_key_basic::export_both() const
 	if (!has_private_ || !has_public_)
 		return std::string();
 
-	return export_private() + export_public();
+	std::string result(private_size() + public_size(), 0);
+	unsigned char *output = reinterpret_cast<unsigned char *>(&result[0]);
+
+	write_private(output);
+	write_public(output + private_size());
+
+	return result;
 }
 
-bool sidh_key_basic::import_private(const std::string& input)
+/* Earlier versions bounded the scalars of side A by 2^373 instead of
+   2^372, so those up to the old bound are accepted and reduced modulo
+   le, which gives the same kernel and keeps their parity.  */
+bool sidh_key_basic::read_private(const unsigned char *input)
 {
-	Z m, n;
-
-	if (input.size() != get_params().le.size() + 1)
-		return false;
+	const Z& le = get_params().le;
+	Z m, n, bound = get_params().s == sidh_params::side::A ? Z(le * 2) : le;
+	size_t size = le.size();
 
-	if (input[0] == ((char) 0)) {
+	if (input[0] == 0) {
 		m = 1;
-		n.unserialize(input.substr(1));
+		n.unserialize(input + 1, size);
 
-		if (n >= get_params().le)
+		if (n >= bound)
 			return false;
-	} else if (input[0] == ((char) 1)) {
-		m.unserialize(input.substr(1));
+		n %= le;
+	} else if (input[0] == 1) {
+		m.unserialize(input + 1, size);
 		n = 1;
 
-		if (m >= get_params().le)
+		if (m >= bound)
 			return false;
+		m %= le;
 	} else {
 		return false;
 	}
@@ -166,31 +339,28 @@ bool sidh_key_basic::import_private(const std::string& input)
 	return true;
 }
 
-bool sidh_key_basic::import_public(const std::string& input)
+bool sidh_key_basic::read_public(const unsigned char *input)
 {
 	size_t curve_size = curve_->size();
 	size_t point_size = P_image_.size();
 
-	if (input.size() != curve_size + 2*point_size)
-		return false;
-
-	WeierstrassCurvePtr curve = std::make_shared<WeierstrassCurve>(get_params().prime);
+	WeierstrassCurvePtr<field> curve = std::make_shared<WeierstrassCurve<field>>(get_params().prime);
 
-	if (!curve->unserialize(input.substr(0, curve_size)))
+	if (!curve->unserialize(input))
 		return false;
 
-	WeierstrassPoint P_image(curve);
-	WeierstrassPoint Q_image(curve);
+	WeierstrassPoint<field> P_image{WeierstrassCurveHandle<field>(curve)};
+	WeierstrassPoint<field> Q_image{WeierstrassCurveHandle<field>(curve)};
 
-	if (!P_image.unserialize(input.substr(curve_size, point_size)))
+	if (!P_image.unserialize(input + curve_size))
 		return false;
 
-	if (!Q_image.unserialize(input.substr(curve_size + point_size, point_size)))
+	if (!Q_image.unserialize(input + curve_size + point_size))
 		return false;
 
-	curve_ = curve;
-	P_image_ = P_image;
-	Q_image_ = Q_image;
+	curve_ = std::move(curve);
+	P_image_ = std::move(P_image);
+	Q_image_ = std::move(Q_image);
 
 	has_private_ = false;
 	has_isogeny_ = false;
@@ -199,22 +369,39 @@ bool sidh_key_basic::import_public(const std::string& input)
 	return true;
 }
 
+bool sidh_key_basic::import_private(const std::string& input)
+{
+	if (input.size() != private_size())
+		return false;
+
+	return read_private(reinterpret_cast<const unsigned char *>(input.data()));
+}
+
+bool sidh_key_basic::import_public(const std::string& input)
+{
+	if (input.size() != public_size())
+		return false;
+
+	return read_public(reinterpret_cast<const unsigned char *>(input.data()));
+}
+
 bool sidh_key_basic::import(const std::string& input)
 {
-	size_t private_size = get_params().le.size() + 1;
-	size_t public_size = curve_->size() + 2*P_image_.size();
+	size_t private_size = sidh_key_basic::private_size();
+	size_t public_size = sidh_key_basic::public_size();
+	const unsigned char *buffer = reinterpret_cast<const unsigned char *>(input.data());
 
 	if (input.size() == private_size) {
-		return sidh_key_basic::import_private(input);
+		return read_private(buffer);
 	} else if (input.size() == public_size) {
-		return sidh_key_basic::import_public(input);
+		return read_public(buffer);
 	} else if (input.size() == private_size + public_size) {
 		Z old_m = m_, old_n = n_;
 		bool old_has_private = has_private_, old_has_isogeny = has_isogeny_;
 
-		if (!sidh_key_basic::import_private(input.substr(0, private_size))) {
+		if (!read_private(buffer)) {
 			return false;
-		} else if (!sidh_key_basic::import_public(input.substr(private_size))) {
+		} else if (!read_public(buffer + private_size)) {
 			m_ = old_m;
 			n_ = old_n;
 			has_private_ = old_has_private;
@@ -236,6 +423,16 @@ const sidh_params& sidh_key_basic::get_params() const
 	return params_;
 }
 
+sidh_key_basic::engine sidh_key_basic::get_engine() const
+{
+	return engine_;
+}
+
+void sidh_key_basic::set_engine(engine e)
+{
+	engine_ = e;
+}
+
 const Z& sidh_key_basic::get_m() const
 {
 	return m_;
@@ -246,23 +443,23 @@ const Z& sidh_key_basic::get_n() const
 	return n_;
 }
 
-const WeierstrassIsogeny& sidh_key_basic::get_isogeny()
+const WeierstrassIsogeny<sidh_key_basic::field>& sidh_key_basic::get_isogeny()
 {
 	ensure_has_isogeny();
 	return isogeny_;
 }
 
-const WeierstrassPoint& sidh_key_basic::get_P_image() const
+const WeierstrassPoint<sidh_key_basic::field>& sidh_key_basic::get_P_image() const
 {
 	return P_image_;
 }
 
-const WeierstrassPoint& sidh_key_basic::get_Q_image() const
+const WeierstrassPoint<sidh_key_basic::field>& sidh_key_basic::get_Q_image() const
 {
 	return Q_image_;
 }
 
-const WeierstrassCurvePtr& sidh_key_basic::get_curve_image() const
+const WeierstrassCurvePtr<sidh_key_basic::field>& sidh_key_basic::get_curve_image() const
 {
 	return curve_;
 }
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <pqc_thread_pool.hpp>
+
+namespace pqc
+{
+
+thread_pool::thread_pool(unsigned threads, std::size_t threshold) :
+	threshold_(threshold),
+	job_(nullptr),
+	n_(0),
+	chunks_(0),
+	next_(0),
+	pending_(0),
+	generation_(0),
+	stop_(false)
+{
+	for (unsigned i = 1; i < threads; ++i)
+		workers_.emplace_back(&thread_pool::worker, this);
+}
+
+thread_pool::~thread_pool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	start_.notify_all();
+
+	for (auto& thread : workers_)
+		thread.join();
+}
+
+unsigned thread_pool::threads() const
+{
+	return workers_.size() + 1;
+}
+
+std::size_t thread_pool::threshold() const
+{
+	return threshold_;
+}
+
+void thread_pool::run(std::size_t n, const std::function<void(std::size_t, std::size_t)>& f)
+{
+	if (n < threshold_ || workers_.empty() || !busy_.try_lock()) {
+		f(0, n);
+		return;
+	}
+
+	std::lock_guard<std::mutex> busy(busy_, std::adopt_lock);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		job_ = &f;
+		n_ = n;
+		chunks_ = std::min<std::size_t>(n, threads());
+		next_ = 0;
+		pending_ = chunks_;
+		++generation_;
+	}
+	start_.notify_all();
+
+	work();
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	done_.wait(lock, [this] { return pending_ == 0; });
+	job_ = nullptr;
+}
+
+/* Takes the chunks of the current loop until there are none left */
+void thread_pool::work()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	while (job_ && next_ < chunks_) {
+		const auto& f = *job_;
+		std::size_t chunk = next_++, n = n_, chunks = chunks_;
+
+		lock.unlock();
+		f(chunk * n / chunks, (chunk + 1) * n / chunks);
+		lock.lock();
+
+		if (--pending_ == 0)
+			done_.notify_all();
+	}
+}
+
+void thread_pool::worker()
+{
+	unsigned long seen = 0;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			start_.wait(lock, [this, seen] { return stop_ || generation_ != seen; });
+			if (stop_)
+				return;
+			seen = generation_;
+		}
+		work();
+	}
+}
+
+static std::mutex isogeny_pool_mutex;
+static std::shared_ptr<thread_pool> isogeny_pool_instance;
+
+std::shared_ptr<thread_pool> thread_pool::isogeny_pool()
+{
+	std::lock_guard<std::mutex> lock(isogeny_pool_mutex);
+	return isogeny_pool_instance;
+}
+
+void thread_pool::set_isogeny_pool(std::shared_ptr<thread_pool> pool)
+{
+	std::lock_guard<std::mutex> lock(isogeny_pool_mutex);
+	isogeny_pool_instance = std::move(pool);
+}
+
+}
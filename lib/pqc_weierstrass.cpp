@@ -1,41 +1,139 @@
+#include <algorithm>
 #include <pqc_weierstrass.hpp>
 #include <pqc_random.hpp>
 
 namespace pqc {
 
-WeierstrassSmallIsogeny WeierstrassCurve::small_isogeny (const WeierstrassPoint& generator, int l) const
-{
-	GF t = a*(l-1), w = 2*(l-1)*b;
-	if (l == 2) {
-		/* σ  = x(generator)
-		   σ₂ = 0
-		   σ₃ = 0  */
-		const GF& s = generator.x;
-		GF ss = s.square();
-		t += 3*ss;
-		w += 3*a*s + 5*ss*s;
-	} else if (l == 3) {
-		/* σ  = 2·x(generator)
-		   σ₂ = x(generator)²
-		   σ₃ = 0  */
-		GF s = 2*generator.x;
-		GF s2 = generator.x.square();
-		GF ss = 4 * s2;
-		t += 3*(ss - 2*s2);
-		w += 3*a*s + 5*(ss*s - 3*s*s2);
-	} else {
-		
+/* See WeierstrassSmallIsogeny for the formulas.  For degree 4 the kernel
+   points G and 2G are brought to the common z = z(G)·z(2G) first.  */
+template<typename F>
+WeierstrassSmallIsogeny<F> WeierstrassCurve<F>::small_isogeny (const WeierstrassJacobianPoint<F>& generator, int l, WeierstrassCurve& image) const
+{
+	WeierstrassSmallIsogeny<F> res(WeierstrassCurveHandle<F>(&image), l);
+	F x = generator.x, y = generator.y, zeta = generator.z;
+
+	if (l == 4) {
+		WeierstrassJacobianPoint<F> T(generator);
+		T.double_inplace();
+
+		F tzz = T.z.square();
+		x *= tzz;
+		y *= tzz * T.z;
+		res.m_x[1] = T.x * zeta.square();
+		zeta *= T.z;
+	}
+
+	res.m_zz = zeta.square();
+	res.m_zzz = res.m_zz * zeta;
+	F azzzz = a * res.m_zz.square();
+
+	res.m_x[0] = x;
+	res.m_v[0] = 3*x.square() + azzzz;
+	res.m_u[0] = F(a.get_p());
+	res.m_terms = 1;
+
+	if (l != 2) {
+		res.m_v[0] += res.m_v[0];
+		res.m_u[0] = 4*y.square();
 	}
-	return WeierstrassSmallIsogeny(std::make_shared<WeierstrassCurve>(a - 5*t, b - 7*w), generator, l);
+
+	if (l == 4) {
+		res.m_v[1] = 3*res.m_x[1].square() + azzzz;
+		res.m_u[1] = F(a.get_p());
+		res.m_terms = 2;
+	}
+
+	F v = res.m_v[0], w = res.m_u[0] + res.m_x[0]*res.m_v[0];
+	if (l == 4) {
+		v += res.m_v[1];
+		w += res.m_x[1]*res.m_v[1];
+	}
+
+	image = WeierstrassCurve(azzzz - 5*v, b*res.m_zzz.square() - 7*w);
+	return res;
+}
+
+template<typename F>
+WeierstrassSmallIsogeny<F> WeierstrassCurve<F>::small_isogeny (const WeierstrassPoint<F>& generator, int l, WeierstrassCurve& image) const
+{
+	return small_isogeny(WeierstrassJacobianPoint<F>(generator), l, image);
+}
+
+template<typename F>
+void WeierstrassSmallIsogeny<F>::evaluate(WeierstrassJacobianPoint<F> *first, WeierstrassJacobianPoint<F> *last) const
+{
+	for (WeierstrassJacobianPoint<F> *P = first; P != last; ++P) {
+		P->m_curve = m_image;
+		if (P->is_identity())
+			continue;
+
+		F zz = P->z.square();
+		F d[2], sx, sy;
+
+		P->x *= m_zz;
+		P->y *= m_zzz;
+
+		for (int i = 0; i < m_terms; ++i)
+			d[i] = P->x - m_x[i] * zz;
+
+		F pi = d[0];
+		if (m_terms == 2)
+			pi *= d[1];
+
+		for (int i = 0; i < m_terms; ++i) {
+			F tx = m_v[i] * d[i], ty;
+			if (m_u[i]) {
+				F uzz = m_u[i] * zz;
+				tx += uzz;
+				ty = tx + uzz;
+			} else {
+				ty = tx;
+			}
+
+			if (m_terms == 2) {
+				const F& other = d[1 - i];
+				F oo = other.square();
+				tx *= oo;
+				ty *= oo * other;
+			}
+
+			if (i) {
+				sx += tx;
+				sy += ty;
+			} else {
+				sx = tx;
+				sy = ty;
+			}
+		}
+
+		F zzzz = zz.square(), pipi = pi.square();
+		P->x = P->x * pipi + zzzz * sx;
+		P->y *= pipi * pi - zzzz * sy;
+		P->z *= pi;
+	}
+}
+
+template<typename F>
+void WeierstrassSmallIsogeny<F>::evaluate(WeierstrassPoint<F> *first, WeierstrassPoint<F> *last) const
+{
+	std::vector<WeierstrassJacobianPoint<F>> R;
+
+	R.reserve(last - first);
+	for (WeierstrassPoint<F> *P = first; P != last; ++P)
+		R.emplace_back(*P);
+
+	evaluate(R.data(), R.data() + R.size());
+	WeierstrassJacobianPoint<F>::affine_batch(R.data(), R.data() + R.size(), first);
 }
 
-WeierstrassPoint WeierstrassCurve::random_point() const
+template<typename F>
+WeierstrassPoint<F> WeierstrassCurve<F>::random_point() const
 {
-	GF x(a.get_p()), y(a.get_p());
+	const Z& p = a.get_p();
+	F x(p), y(p);
 
 	do {
-		x.a = random_z_below(x.get_p());
-		x.b = random_z_below(x.get_p());
+		x = F(p, random_z_below(p), random_z_below(p));
 		y = (x.square() + a)*x + b;
 	} while (!y.is_square());
 
@@ -44,120 +142,821 @@ WeierstrassPoint WeierstrassCurve::random_point() const
 	if (random_u32_below(2))
 		y = -y;
 
-	return WeierstrassPoint(shared_from_this(), x, y);
+	return WeierstrassPoint<F>(WeierstrassCurveHandle<F>(this), x, y);
 }
 
-WeierstrassPoint WeierstrassCurve::torsion_point(const Z& cofactor, const Z& factor_div_p) const
+template<typename F>
+WeierstrassPoint<F> WeierstrassCurve<F>::torsion_point(const Z& cofactor, const Z& factor_div_p,
+						       multiplication_policy policy) const
 {
-	WeierstrassPoint P;
+	WeierstrassPoint<F> P;
 	do {
-		P = random_point() * cofactor;
-	} while ((P * factor_div_p).is_identity());
+		P = random_point().multiply(cofactor, policy);
+	} while (P.multiply(factor_div_p, policy).is_identity());
 	return P;
 }
 
-std::pair<WeierstrassPoint, WeierstrassPoint> WeierstrassCurve::basis(int la, int ea, int lb, int eb, int f) const
+template<typename F>
+std::pair<WeierstrassPoint<F>, WeierstrassPoint<F>> WeierstrassCurve<F>::basis(int la, int ea, int lb, int eb, int f,
+									       multiplication_policy policy) const
 {
 	Z cofactor = Z(lb).pow(eb)*f;
 	Z factor_div_p = Z(la).pow(ea-1);
 	Z factor = factor_div_p * la;
 
-	WeierstrassPoint P = torsion_point(cofactor, factor_div_p), Q;
+	WeierstrassPoint<F> P = torsion_point(cofactor, factor_div_p, policy), Q;
 	do {
-		Q = torsion_point(cofactor, factor_div_p);
-	} while (P.weil_pairing(Q, factor).pow(factor_div_p) == 1);
+		Q = torsion_point(cofactor, factor_div_p, policy);
+	} while (P.tate_pairing(Q, factor).pow(factor_div_p) == 1);
 	return std::make_pair(P, Q);
 }
 
-GF WeierstrassPoint::line(const WeierstrassPoint& R, const WeierstrassPoint& Q) const
+template<typename F>
+WeierstrassPoint<F> WeierstrassCurve<F>::point_at(const F& x) const
+{
+	F y = (x.square() + a)*x + b;
+
+	if (!y.is_square())
+		return WeierstrassPoint<F>(WeierstrassCurveHandle<F>(this));
+
+	y.sqrt();
+	return WeierstrassPoint<F>(WeierstrassCurveHandle<F>(this), x, y);
+}
+
+template<typename F>
+std::pair<WeierstrassPoint<F>, WeierstrassPoint<F>> WeierstrassCurve<F>::deterministic_basis(int la, int ea, int lb, int eb, int f) const
+{
+	const Z& p = a.get_p();
+	Z cofactor = Z(lb).pow(eb)*f;
+	WeierstrassPoint<F> P, Q, T;
+	unsigned long k = 0;
+
+	do {
+		++k;
+		WeierstrassPoint<F> candidate = point_at(F(p, k, k*k));
+		if (candidate.is_identity())
+			continue;
+		P = candidate.multiply(cofactor, multiplication_policy::WNAF);
+		T = P.multiply_by_power(la, ea-1);
+	} while (T.is_identity());
+
+	for (;;) {
+		++k;
+		WeierstrassPoint<F> candidate = point_at(F(p, k, k*k));
+		if (!candidate.is_identity() && T.tate_pairing(candidate, la) != 1)
+			return std::make_pair(P, candidate.multiply(cofactor, multiplication_policy::WNAF));
+	}
+}
+
+/* The Montgomery ladder with R₀ = k·P, R₁ = (k + 1)·P: each bit adds the
+   two and doubles the one the bit selects, so that every bit costs one
+   general addition and one doubling whatever its value.  */
+template<typename F>
+WeierstrassPoint<F> WeierstrassPoint<F>::operator*(const Z& n) const
+{
+	if (identity || n == 0)
+		return WeierstrassPoint(m_curve);
+	else if (n < 0)
+		return -*this * Z(-n);
+
+	WeierstrassJacobianPoint<F> R[2] = { WeierstrassJacobianPoint<F>(*this), WeierstrassJacobianPoint<F>(*this) };
+	R[1].double_inplace();
+
+	for (std::ptrdiff_t i = n.bit_length() - 2; i >= 0; --i) {
+		int bit = n.testbit(i);
+		R[1 - bit] += R[bit];
+		R[bit].double_inplace();
+	}
+
+	return R[0].affine();
+}
+
+/* The digits of the width-w NAF from the lowest, each zero or odd with
+   |d| < 2^(w-1), reading windows of the bits of n with the carry of the
+   digits made negative, as in libsecp256k1.  */
+static std::vector<int> wnaf_digits(const Z& n, int w)
+{
+	std::size_t bits = n.bit_length();
+	std::vector<int> digits(bits + w + 1, 0);
+	std::size_t i = 0;
+	int carry = 0;
+
+	while (i < bits || carry) {
+		if (int(n.testbit(i)) == carry) {
+			++i;
+			continue;
+		}
+
+		int word = carry;
+		for (int j = 0; j < w; ++j)
+			word += int(n.testbit(i + j)) << j;
+
+		carry = (word >> (w - 1)) & 1;
+		digits[i] = word - (carry << w);
+		i += w;
+	}
+
+	while (digits.size() > 1 && !digits.back())
+		digits.pop_back();
+
+	return digits;
+}
+
+template<typename F>
+WeierstrassPoint<F> WeierstrassPoint<F>::multiply(const Z& n, multiplication_policy policy, int width) const
+{
+	if (policy == multiplication_policy::LADDER)
+		return *this * n;
+
+	if (identity || n == 0)
+		return WeierstrassPoint(m_curve);
+	else if (n < 0)
+		return (-*this).multiply(Z(-n), policy, width);
+
+	/* left to right, the additions are mixed ones with the point itself */
+	if (policy == multiplication_policy::DOUBLE_AND_ADD) {
+		WeierstrassJacobianPoint<F> R(*this);
+
+		for (std::ptrdiff_t i = n.bit_length() - 2; i >= 0; --i) {
+			R.double_inplace();
+			if (n.testbit(i))
+				R += *this;
+		}
+
+		return R.affine();
+	}
+
+	if (!width) {
+		std::size_t bits = n.bit_length();
+		width = bits < 24 ? 2 : bits < 96 ? 3 : bits < 320 ? 4 : 5;
+	} else {
+		width = std::min(std::max(width, 2), 8);
+	}
+
+	std::vector<int> digits = wnaf_digits(n, width);
+
+	/* P, 3P, 5P, ... */
+	std::size_t size = std::size_t(1) << (width - 2);
+	std::vector<WeierstrassJacobianPoint<F>> odd(size, WeierstrassJacobianPoint<F>(*this));
+	std::vector<WeierstrassPoint<F>> table(size);
+	WeierstrassJacobianPoint<F> P2(*this);
+
+	P2.double_inplace();
+	for (std::size_t i = 1; i < size; ++i) {
+		odd[i] = odd[i - 1];
+		odd[i] += P2;
+	}
+	WeierstrassJacobianPoint<F>::affine_batch(odd.data(), odd.data() + size, table.data());
+
+	WeierstrassJacobianPoint<F> R(table[digits.back() / 2]);
+
+	for (std::size_t i = digits.size() - 1; i-- > 0;) {
+		R.double_inplace();
+		if (digits[i] > 0)
+			R += table[digits[i] / 2];
+		else if (digits[i] < 0)
+			R += -table[-digits[i] / 2];
+	}
+
+	return R.affine();
+}
+
+template<typename F>
+WeierstrassPoint<F> WeierstrassPoint<F>::linear_combination(const Z& m, const WeierstrassPoint& P, const Z& n, const WeierstrassPoint& Q)
+{
+	if (m < 0)
+		return linear_combination(Z(-m), -P, n, Q);
+	else if (n < 0)
+		return linear_combination(m, P, Z(-n), -Q);
+
+	WeierstrassPoint PQ = P + Q;
+	const WeierstrassPoint *summands[] = { &P, &P, &Q, &PQ };
+	WeierstrassJacobianPoint<F> R(WeierstrassPoint(P.m_curve));
+
+	for (std::ptrdiff_t i = std::max(m.bit_length(), n.bit_length()) - 1; i >= 0; --i) {
+		R.double_inplace();
+		int bits = m.testbit(i) | n.testbit(i) << 1;
+		R.add_if(*summands[bits], bits);
+	}
+
+	return R.affine();
+}
+
+template<typename F>
+WeierstrassPoint<F> WeierstrassPoint<F>::multiply_by_power(int base, int exp) const
+{
+	if (identity || exp == 0)
+		return *this;
+
+	return WeierstrassJacobianPoint<F>(*this).multiply_by_power_inplace(base, exp).affine();
+}
+
+template<typename F>
+WeierstrassJacobianPoint<F>::WeierstrassJacobianPoint(const WeierstrassPoint<F>& P) :
+	m_curve(P.m_curve), x(P.x), y(P.y), z(P.x.get_p(), P.identity ? 0 : 1)
+{
+}
+
+template<typename F>
+WeierstrassJacobianPoint<F>& WeierstrassJacobianPoint<F>::multiply_by_power_inplace(int base, int exp)
+{
+	if (base == 2)
+		return double_times_inplace(exp);
+	if (base == 3)
+		return triple_times_inplace(exp);
+
+	int top = 0;
+
+	while (base >> (top + 1))
+		++top;
+
+	for (int i = 0; i < exp && !is_identity(); ++i) {
+		WeierstrassJacobianPoint S(*this);
+		for (int j = top - 1; j >= 0; --j) {
+			double_inplace();
+			if ((base >> j) & 1)
+				*this += S;
+		}
+	}
+
+	return *this;
+}
+
+template<typename F>
+void WeierstrassJacobianPoint<F>::add_if(const WeierstrassPoint<F>& P, bool condition)
+{
+	WeierstrassJacobianPoint S(*this);
+	S += P;
+	if (condition)
+		std::swap(*this, S);
+}
+
+/* dbl-2007-bl:
+     S = 2·((x + y²)² - x² - y⁴),  M = 3x² + a·z⁴
+     x' = M² - 2S,  y' = M·(S - x') - 8y⁴,  z' = (y + z)² - y² - z²  */
+template<typename F>
+WeierstrassJacobianPoint<F>& WeierstrassJacobianPoint<F>::double_inplace()
+{
+	if (is_identity())
+		return *this;
+
+	F xx = x.square(), yy = y.square(), zz = z.square();
+	F yyyy = yy.square();
+	F s = (x + yy).square() - xx - yyyy;
+	s += s;
+	F m = xx + xx + xx + m_curve->a * zz.square();
+
+	z += y;
+	z.square_inplace();
+	z -= yy;
+	z -= zz;
+
+	x = m.square() - s - s;
+
+	yyyy += yyyy;
+	yyyy += yyyy;
+	yyyy += yyyy;
+	y = m * (s - x) - yyyy;
+
+	return *this;
+}
+
+/* mdbl-2007-bl, dbl-2007-bl keeping w = a·z⁴ alongside:
+     S = 2·((x + y²)² - x² - y⁴),  M = 3x² + w,  U = 8y⁴
+     x' = M² - 2S,  y' = M·(S - x') - U,  z' = 2y·z,  w' = 2U·w
+   which trades the squarings of z for two multiplications and does not
+   multiply by a.  */
+template<typename F>
+WeierstrassJacobianPoint<F>& WeierstrassJacobianPoint<F>::double_times_inplace(int e)
+{
+	if (e <= 0 || is_identity())
+		return *this;
+
+	F w = z.square();
+	w.square_inplace();
+	w *= m_curve->a;
+
+	for (int i = 0; i < e && !is_identity(); ++i) {
+		F xx = x.square(), yy = y.square();
+		F u = yy.square();
+		F s = (x + yy).square() - xx - u;
+		s += s;
+		F m = xx + xx + xx + w;
+
+		z *= y;
+		z += z;
+
+		x = m.square() - s - s;
+
+		u += u;
+		u += u;
+		u += u;
+		y = m * (s - x) - u;
+
+		if (i < e - 1) {
+			w *= u;
+			w += w;
+		}
+	}
+
+	return *this;
+}
+
+/* tpl-2007-bl:
+     M = 3x² + a·z⁴,  E = 6·((x + y²)² - x² - y⁴) - M²,  T = 16y⁴,
+     U = (M + E)² - M² - E² - T
+     x' = 4·(x·E² - 4y²·U),  y' = 8y·(U·(T - U) - E·E²),
+     z' = (z + E)² - z² - E²
+   E = 0 for points of order three, whose triple is the identity.  */
+template<typename F>
+WeierstrassJacobianPoint<F>& WeierstrassJacobianPoint<F>::triple_inplace()
+{
+	if (is_identity())
+		return *this;
+
+	F xx = x.square(), yy = y.square(), zz = z.square();
+	F yyyy = yy.square();
+	F m = xx + xx + xx + m_curve->a * zz.square();
+	F mm = m.square();
+	F e = (x + yy).square() - xx - yyyy;
+	e += e + e;
+	e += e;
+	e -= mm;
+	F ee = e.square();
+	F t = yyyy + yyyy;
+	t += t;
+	t += t;
+	t += t;
+	F u = (m + e).square() - mm - ee - t;
+
+	z += e;
+	z.square_inplace();
+	z -= zz;
+	z -= ee;
+
+	yy *= u;
+	yy += yy;
+	yy += yy;
+	x *= ee;
+	x -= yy;
+	x += x;
+	x += x;
+
+	t -= u;
+	t *= u;
+	ee *= e;
+	t -= ee;
+	y *= t;
+	y += y;
+	y += y;
+	y += y;
+
+	return *this;
+}
+
+template<typename F>
+WeierstrassJacobianPoint<F>& WeierstrassJacobianPoint<F>::triple_times_inplace(int e)
+{
+	for (int i = 0; i < e && !is_identity(); ++i)
+		triple_inplace();
+
+	return *this;
+}
+
+/* add-2007-bl:
+     u₁ = x₁·z₂²,  u₂ = x₂·z₁²,  s₁ = y₁·z₂³,  s₂ = y₂·z₁³
+     h = u₂ - u₁,  i = (2h)²,  j = h·i,  r = 2·(s₂ - s₁),  v = u₁·i
+     x₃ = r² - j - 2v,  y₃ = r·(v - x₃) - 2·s₁·j,
+     z₃ = ((z₁ + z₂)² - z₁² - z₂²)·h
+   h = 0 means that the points are equal or opposite.  */
+template<typename F>
+WeierstrassJacobianPoint<F>& WeierstrassJacobianPoint<F>::operator+=(const WeierstrassJacobianPoint& other)
+{
+	if (other.is_identity())
+		return *this;
+	if (is_identity())
+		return *this = other;
+
+	F z1z1 = z.square(), z2z2 = other.z.square();
+	F u1 = x * z2z2, u2 = other.x * z1z1;
+	F s1 = y * other.z * z2z2, s2 = other.y * z * z1z1;
+	F h = u2 - u1, r = s2 - s1;
+
+	if (!h) {
+		if (!r)
+			return double_inplace();
+		z = F(z.get_p());
+		return *this;
+	}
+
+	r += r;
+	F i = (h + h).square();
+	F j = h * i;
+	F v = u1 * i;
+
+	x = r.square() - j - v - v;
+	s1 *= j;
+	y = r * (v - x) - s1 - s1;
+	z += other.z;
+	z.square_inplace();
+	z -= z1z1;
+	z -= z2z2;
+	z *= h;
+
+	return *this;
+}
+
+/* madd-2007-bl, add-2007-bl with z₂ = 1:
+     u₂ = x₂·z₁²,  s₂ = y₂·z₁³,  h = u₂ - x₁,  i = 4h²,  j = h·i,
+     r = 2·(s₂ - y₁),  v = x₁·i
+     x₃ = r² - j - 2v,  y₃ = r·(v - x₃) - 2·y₁·j,  z₃ = (z₁ + h)² - z₁² - h²  */
+template<typename F>
+WeierstrassJacobianPoint<F>& WeierstrassJacobianPoint<F>::operator+=(const WeierstrassPoint<F>& other)
+{
+	if (other.identity)
+		return *this;
+	if (is_identity())
+		return *this = WeierstrassJacobianPoint(other);
+
+	F z1z1 = z.square();
+	F h = other.x * z1z1 - x, r = other.y * z * z1z1 - y;
+
+	if (!h) {
+		if (!r)
+			return double_inplace();
+		z = F(z.get_p());
+		return *this;
+	}
+
+	r += r;
+	F hh = h.square();
+	F i = hh + hh;
+	i += i;
+	F j = h * i;
+	F v = x * i;
+
+	x = r.square() - j - v - v;
+	j *= y;
+	y = r * (v - x) - j - j;
+	z += h;
+	z.square_inplace();
+	z -= z1z1;
+	z -= hh;
+
+	return *this;
+}
+
+template<typename F>
+WeierstrassPoint<F> WeierstrassJacobianPoint<F>::affine() const
+{
+	if (is_identity())
+		return WeierstrassPoint<F>(m_curve);
+
+	F zi = z.inverse();
+	F zi2 = zi.square();
+	return WeierstrassPoint<F>(m_curve, x * zi2, y * zi2 * zi);
+}
+
+template<typename F>
+void WeierstrassJacobianPoint<F>::affine_batch(const WeierstrassJacobianPoint *first, const WeierstrassJacobianPoint *last, WeierstrassPoint<F> *out)
+{
+	std::vector<F> zi;
+
+	zi.reserve(last - first);
+	for (const WeierstrassJacobianPoint *P = first; P != last; ++P)
+		zi.push_back(P->z);
+
+	F::batch_invert(zi.data(), zi.data() + zi.size());
+
+	for (std::size_t i = 0; i < zi.size(); ++i) {
+		const WeierstrassJacobianPoint& P = first[i];
+		if (P.is_identity()) {
+			out[i] = WeierstrassPoint<F>(P.m_curve);
+		} else {
+			F zi2 = zi[i].square();
+			out[i] = WeierstrassPoint<F>(P.m_curve, P.x * zi2, P.y * zi2 * zi[i]);
+		}
+	}
+}
+
+/* The line through this and R evaluated at Q, as the fraction num/den so
+   that no inversion is needed.  */
+template<typename F>
+void WeierstrassPoint<F>::line(const WeierstrassPoint& R, const WeierstrassPoint& Q, F& num, F& den) const
 {
 	const Z& p = m_curve->a.get_p();
 	const WeierstrassPoint& P = *this;
 
-	if (Q.is_identity())
-		return GF(p);
+	den = F(p, 1);
+
+	if (Q.is_identity()) {
+		num = F(p);
+		return;
+	}
 
 	if (P.is_identity() || R.is_identity()) {
 		if (P == R)
-			return GF(p, 1);
+			num = F(p, 1);
 		else if (P.is_identity())
-			return Q.x - R.x;
+			num = Q.x - R.x;
 		else
-			return Q.x - P.x;
+			num = Q.x - P.x;
 	} else if (P != R) {
 		if (P.x == R.x) {
-			return Q.x - P.x;
+			num = Q.x - P.x;
 		} else {
-			GF l = (R.y - P.y) / (R.x - P.x);
-			return (Q.y - P.y) - l*(Q.x - P.x);
+			/* l = (R.y - P.y) / (R.x - P.x) */
+			den = R.x - P.x;
+			num = (Q.y - P.y)*den - (R.y - P.y)*(Q.x - P.x);
 		}
 	} else {
 		if (P.y == 0) {
-			return Q.x - P.x;
+			num = Q.x - P.x;
 		} else {
-			GF l = (3*P.x.square() + m_curve->a) / (2*P.y);
-			return (Q.y - P.y) - l*(Q.x - P.x);
+			/* l = (3·P.x² + a) / (2·P.y) */
+			den = 2*P.y;
+			num = (Q.y - P.y)*den - (3*P.x.square() + m_curve->a)*(Q.x - P.x);
 		}
 	}
 }
 
-GF WeierstrassPoint::miller(const WeierstrassPoint& Q, Z n) const
+template<typename F>
+F WeierstrassPoint<F>::line(const WeierstrassPoint& R, const WeierstrassPoint& Q) const
+{
+	F num, den;
+	line(R, Q, num, den);
+	return num / den;
+}
+
+/* The Miller function accumulated as the fraction num/den, each step
+   multiplies the numerator by l·v_den and the denominator by l_den·v
+   instead of dividing by the vertical line.  V is kept in Jacobian
+   coordinates, so the whole loop needs no inversion.  */
+template<typename F>
+void WeierstrassPoint<F>::miller(const WeierstrassPoint& Q, Z n, F& num, F& den) const
 {
 	const Z& p = m_curve->a.get_p();
 	const WeierstrassPoint& P = *this;
 
-	if (Q.is_identity() || n == 0)
-		return GF(p);
+	den = F(p, 1);
+
+	if (Q.is_identity() || n == 0) {
+		num = F(p);
+		return;
+	}
 
 	bool neg = n < 0;
 	if (neg)
 		n = -n;
 
-	GF t(p, 1), l, v;
-	WeierstrassPoint V(P), S(2*V);
+	F ln, ld, vn, vd;
+	WeierstrassJacobianPoint<F> V(P);
+
+	num = F(p, 1);
 
 	for (std::ptrdiff_t i = n.bit_length() - 2; i >= 0; --i) {
-		S = 2*V;
-		l = V.line(V, Q);
-		v = S.line(-S, Q);
-		t = t.square() * (l/v);
-		V = S;
+		Q.miller_double(V, ln, ld);
+		num = num.square() * ln;
+		den = den.square() * ld;
 		if (n.testbit(i)) {
-			S = V + P;
-			l = V.line(P, Q);
-			v = S.line(-S, Q);
-			t *= (l/v);
-			V = S;
+			Q.miller_add(V, P, ln, ld);
+			num *= ln;
+			den *= ld;
 		}
 	}
 
 	if (neg) {
-		v = V.line(-V, Q);
-		t = (t*v).inverse();
+		WeierstrassPoint A = V.affine();
+		A.line(-A, Q, vn, vd);
+		F t = num * vn;
+		num = den * vd;
+		den = t;
 	}
+}
 
-	return t;
+/* For V = (X : Y : Z) with Y ≠ 0 the tangent at V evaluated at this point
+   (x, y), multiplied by 2Y·Z³, is
+     l = 2Y·Z³·y - 2Y² - (3X² + a·Z⁴)·(x·Z² - X)
+   and the vertical through 2V = (X' : Y' : Z') multiplied by Z'² is
+   x·Z'² - X'.  Z' = 2Y·Z, so the quotient is l·Z' / (Z²·(x·Z'² - X')).
+   Points of order two, whose tangent is vertical, go the affine way.  */
+template<typename F>
+void WeierstrassPoint<F>::miller_double(WeierstrassJacobianPoint<F>& V, F& num, F& den) const
+{
+	if (V.is_identity() || !V.y) {
+		WeierstrassPoint A = V.affine(), S = 2*A;
+		F vn, vd;
+		A.line(A, *this, num, den);
+		S.line(-S, *this, vn, vd);
+		num *= vd;
+		den *= vn;
+		V = WeierstrassJacobianPoint<F>(S);
+		return;
+	}
+
+	F zz = V.z.square();
+	F m = V.x.square();
+	m += m + m;
+	m += m_curve->a * zz.square();
+
+	F yz3 = V.y * zz * V.z;
+	num = yz3 * y - V.y.square();
+	num += num;
+	num -= m * (x * zz - V.x);
+
+	V.double_inplace();
+
+	num *= V.z;
+	den = zz * (x * V.z.square() - V.x);
+}
+
+/* For the affine P = (x₂, y₂) and V = (X : Y : Z) with h = x₂·Z² - X ≠ 0
+   the line through P and V evaluated at this point (x, y), multiplied by
+   Z·h, is
+     l = (y - y₂)·Z·h - (y₂·Z³ - Y)·(x - x₂)
+   and V + P = (X' : Y' : Z') has Z' = 2Z·h, so with the vertical as in
+   miller_double the quotient is 2l·Z' / (x·Z'² - X').  V = ±P goes the
+   affine way.  */
+template<typename F>
+void WeierstrassPoint<F>::miller_add(WeierstrassJacobianPoint<F>& V, const WeierstrassPoint& P, F& num, F& den) const
+{
+	F zz(x.get_p()), h(x.get_p());
+
+	if (!V.is_identity() && !P.identity) {
+		zz = V.z.square();
+		h = P.x * zz - V.x;
+	}
+
+	if (!h) {
+		WeierstrassPoint A = V.affine(), S = A + P;
+		F vn, vd;
+		A.line(P, *this, num, den);
+		S.line(-S, *this, vn, vd);
+		num *= vd;
+		den *= vn;
+		V = WeierstrassJacobianPoint<F>(S);
+		return;
+	}
+
+	F zh = V.z * h;
+	num = (y - P.y) * zh - (P.y * zz * V.z - V.y) * (x - P.x);
+
+	V += P;
+
+	num *= V.z;
+	num += num;
+	den = x * V.z.square() - V.x;
 }
 
-GF WeierstrassPoint::weil_pairing(const WeierstrassPoint& Q, const Z& n) const
+template<typename F>
+F WeierstrassPoint<F>::miller(const WeierstrassPoint& Q, Z n) const
+{
+	F num, den;
+	miller(Q, n, num, den);
+	return num / den;
+}
+
+template<typename F>
+F WeierstrassPoint<F>::weil_pairing(const WeierstrassPoint& Q, const Z& n) const
 {
 	const Z& p = m_curve->a.get_p();
 	const WeierstrassPoint& P = *this;
 
-	if (!(P*n).is_identity() || !(Q*n).is_identity())
-		return GF(p);
+	if (!P.multiply(n, multiplication_policy::WNAF).is_identity() || !Q.multiply(n, multiplication_policy::WNAF).is_identity())
+		return F(p);
 
 	if (P == Q || P.is_identity() || Q.is_identity())
-		return GF(p, 1);
+		return F(p, 1);
 
-	GF denominator = Q.miller(P, n);
-	if (denominator == 0)
-		return GF(p, 1);
+	F den_num, den_den;
+	Q.miller(P, n, den_num, den_den);
+	if (den_num == 0 || den_den == 0)
+		return F(p, 1);
 
-	GF numerator = P.miller(Q, n);
+	F num_num, num_den;
+	P.miller(Q, n, num_num, num_den);
 	if (n.testbit(0))
-		numerator = -numerator;
-	return numerator / denominator;
+		num_num = -num_num;
+
+	/* (num_num/num_den) / (den_num/den_den) with a single inversion */
+	return (num_num * den_den) / (num_den * den_num);
 }
 
+template<typename F>
+F WeierstrassPoint<F>::tate_pairing(const WeierstrassPoint& Q, const Z& n) const
+{
+	const Z& p = m_curve->a.get_p();
+	const WeierstrassPoint& P = *this;
+
+	if (!P.multiply(n, multiplication_policy::WNAF).is_identity())
+		return F(p);
+
+	if (P.is_identity() || Q.is_identity())
+		return F(p, 1);
+
+	F num, den;
+	P.miller(Q, n, num, den);
+	if (num == 0 || den == 0)
+		return F(p, 1);
+
+	return (num / den).pow(Z((p*p - 1) / n));
+}
+
+/* The rows are the multiples by 2^(t·spacing), every other entry is the
+   sum of its lowest row and the entry without it.  */
+template<typename F>
+WeierstrassFixedBase<F>::WeierstrassFixedBase(const WeierstrassPoint<F>& base, std::size_t bits, std::size_t teeth) :
+	WeierstrassFixedBase(base.curve(), bits, teeth)
+{
+	WeierstrassPoint<F> row(base);
+
+	for (std::size_t t = 0; t < m_teeth; ++t) {
+		if (t)
+			row = row.multiply_by_power(2, m_spacing);
+		m_table[std::size_t(1) << t] = row;
+	}
+
+	for (std::size_t j = 3; j < m_table.size(); ++j) {
+		std::size_t low = j & -j;
+		if (j != low)
+			m_table[j] = m_table[low] + m_table[j - low];
+	}
+}
+
+template<typename F>
+WeierstrassPoint<F> WeierstrassFixedBase<F>::multiply_add(const Z& k, const WeierstrassPoint<F>& P) const
+{
+	if (k < 0 || k.bit_length() > m_bits)
+		return base() * k + P;
+
+	WeierstrassJacobianPoint<F> R(WeierstrassPoint<F>(base().curve()));
+
+	for (std::size_t i = m_spacing; i-- > 0;) {
+		R.double_inplace();
+
+		std::size_t column = 0;
+		for (std::size_t t = 0; t < m_teeth; ++t)
+			column |= std::size_t(k.testbit(t * m_spacing + i)) << t;
+		R.add_if(m_table[column ? column : 1], column);
+	}
+
+	R += P;
+	return R.affine();
+}
+
+template<typename F>
+bool WeierstrassFixedBase<F>::is_table_of(const WeierstrassPoint<F>& base) const
+{
+	if (m_table.size() < 2 || m_table[1] != base)
+		return false;
+
+	for (std::size_t t = 1; t < m_teeth; ++t) {
+		std::size_t row = std::size_t(1) << t;
+		if (m_table[row] != m_table[row >> 1].multiply_by_power(2, m_spacing))
+			return false;
+	}
+
+	for (std::size_t j = 3; j < m_table.size(); ++j) {
+		std::size_t low = j & -j;
+		if (j != low && m_table[j] != m_table[low] + m_table[j - low])
+			return false;
+	}
+
+	return true;
+}
+
+template<typename F>
+void WeierstrassFixedBase<F>::serialize(unsigned char *buffer) const
+{
+	std::size_t step = m_table[0].size();
+
+	for (std::size_t j = 1; j < m_table.size(); ++j)
+		m_table[j].serialize(buffer + (j-1) * step);
+}
+
+template<typename F>
+bool WeierstrassFixedBase<F>::unserialize(const unsigned char *buffer)
+{
+	std::size_t step = m_table[0].size();
+
+	for (std::size_t j = 1; j < m_table.size(); ++j)
+		if (!m_table[j].unserialize(buffer + (j-1) * step) || !m_table[j].check())
+			return false;
+	return true;
+}
+
+template class WeierstrassCurve<GF>;
+template class WeierstrassPoint<GF>;
+template class WeierstrassJacobianPoint<GF>;
+template class WeierstrassFixedBase<GF>;
+template class WeierstrassSmallIsogeny<GF>;
+template class WeierstrassIsogeny<GF>;
+
+template class WeierstrassCurve<GF751>;
+template class WeierstrassPoint<GF751>;
+template class WeierstrassJacobianPoint<GF751>;
+template class WeierstrassFixedBase<GF751>;
+template class WeierstrassSmallIsogeny<GF751>;
+template class WeierstrassIsogeny<GF751>;
+
 }
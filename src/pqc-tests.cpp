@@ -1,11 +1,20 @@
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <new>
 #include <chrono>
 #include <vector>
 #include <functional>
+#include <thread>
+#include <atomic>
 #include <pqc_random.hpp>
+#include <pqc_fp751.hpp>
 #include <pqc_weierstrass.hpp>
 #include <pqc_sidh_params.hpp>
+#include <pqc_kex_sidhex.hpp>
+#include <montgomery.hpp>
+#include <pqc_thread_pool.hpp>
 
 using namespace pqc;
 
@@ -24,6 +33,438 @@ void test_squaring () {
 	std::cout << "sqrt(x²)² = " << x << "\n";
 }
 
+bool test_fp751() {
+	const Z& p = Fp751::modulus();
+	int tries = 1000, failures = 0;
+
+	for (int i = 0; i < tries; ++i) {
+		bool ok = true;
+		Z a = random_z_below(p), b = random_z_below(p), c = random_z_below(p), d = random_z_below(p);
+		GF x(p, a, b), y(p, c, d);
+		GF751 x751(p, a, b), y751(p, c, d);
+		GF expected[] = { x + y, x - y, -x, x * y, x.square(), x.inverse(), x * 7, 5 - y };
+		GF751 computed[] = { x751 + y751, x751 - y751, -x751, x751 * y751, x751.square(), x751.inverse(), x751 * 7, 5 - y751 };
+
+		for (size_t j = 0; j < sizeof(expected) / sizeof(expected[0]); ++j) {
+			if (expected[j].a != computed[j].a.get_z() || expected[j].b != computed[j].b.get_z()) {
+				std::cout << "GF751 operation " << j << " failed for " << x << ", " << y << "\n";
+				ok = false;
+			}
+		}
+
+		if (x751.serialize() != x.serialize())
+			ok = false;
+		GF751 unserialized;
+		if (!unserialized.unserialize(x.serialize()) || unserialized != x751)
+			ok = false;
+
+		GF751 s751 = x751.square();
+		s751.sqrt();
+		if (s751.square() != x751.square())
+			ok = false;
+
+		GF s = x.square();
+		s.sqrt();
+		if (s.square() != x.square())
+			ok = false;
+
+		/* elements of the base field are all squares, even those which
+		   are not squares in the base field itself */
+		GF751 r751(p, a);
+		GF r(p, a);
+		r751.sqrt();
+		r.sqrt();
+		if (r751.square() != GF751(p, a) || r.square() != GF(p, a))
+			ok = false;
+
+		/* the exponentiations are slow, check them in every tenth round */
+		if (i % 10 == 0) {
+			Z e1 = random_z_below(p), e2 = random_z(random_u32_below(64) + 1);
+			if (x751.pow(e1) * x751.pow(e2) != x751.pow(e1 + e2))
+				ok = false;
+			if (x751.is_square() != x.is_square() || !x751.square().is_square())
+				ok = false;
+		}
+
+		if (!ok)
+			++failures;
+	}
+
+	std::cout << "GF751 arithmetic matched GF in " << (tries - failures) << " of " << tries << " rounds\n";
+	return failures == 0;
+}
+
+template<typename F>
+bool test_batch_invert(const char *name) {
+	const Z& p = Fp751::modulus();
+	int tries = 100, failures = 0;
+
+	for (int i = 0; i < tries; ++i) {
+		std::vector<F> values, expected;
+
+		for (int j = 0; j < 10; ++j) {
+			if (random_u32_below(4))
+				values.push_back(F(p, random_z_below(p), random_z_below(p)));
+			else
+				values.push_back(F(p));
+			expected.push_back(values.back().inverse());
+		}
+
+		bool all = true;
+		for (const F& x : values)
+			all = all && x;
+
+		if (F::batch_invert(values.data(), values.data() + values.size()) != all || values != expected)
+			++failures;
+	}
+
+	std::cout << name << " batch inversion matched single inversions in " << (tries - failures) << " of " << tries << " rounds\n";
+	return failures == 0;
+}
+
+/* Checks the scalar multiplication in Jacobian coordinates and the fixed
+   base combs against a plain affine double and add.  */
+template<typename F>
+bool test_scalar_multiplication(const char *name) {
+	const Z& p = Fp751::modulus();
+	int tries = 20, failures = 0;
+	WeierstrassCurvePtr<F> curve = std::make_shared<WeierstrassCurve<F>>(F(p, 1), F(p, 0));
+	WeierstrassCurveHandle<F> E(curve);
+
+	for (int i = 0; i < tries; ++i) {
+		WeierstrassPoint<F> P(E, F(p, random_z_below(p), random_z_below(p)));
+		if (!P.curve()) {
+			--i;
+			continue;
+		}
+
+		Z n = random_z(random_u32_below(400) + 1), m = random_z(random_u32_below(64) + 1);
+		WeierstrassPoint<F> expected(E);
+		for (std::ptrdiff_t j = n.bit_length() - 1; j >= 0; --j) {
+			expected += expected;
+			if (n.testbit(j))
+				expected += P;
+		}
+
+		WeierstrassFixedBase<F> comb(P, 400, 4 + i % 3), copy(E, 400, 4 + i % 3);
+		std::string table(comb.size(), 0);
+		comb.serialize(reinterpret_cast<unsigned char *>(&table[0]));
+
+		WeierstrassPoint<F> computed = P * n;
+		if (computed != expected || !computed.check() ||
+		    comb.multiply(n) != expected || comb.multiply_add(m, P) != P * (m + 1) ||
+		    !copy.unserialize(reinterpret_cast<const unsigned char *>(table.data())) || copy.multiply(n) != expected ||
+		    P * (n + m) != computed + P * m || P * -n != -expected ||
+		    P.multiply_by_power(3, 5) != P * 243 || P.multiply_by_power(2, 7) != P * 128 ||
+		    P.multiply_by_power(5, 3) != P * 125 ||
+		    P.multiply(n, multiplication_policy::WNAF) != expected || P.multiply(n, multiplication_policy::DOUBLE_AND_ADD) != expected || P.multiply(-n, multiplication_policy::WNAF, 2 + i % 5) != -expected ||
+		    P.multiply(m, multiplication_policy::WNAF, 2 + i % 5) != P * m ||
+		    P.multiply(n, multiplication_policy::WNAF, i % 2 ? 1 : -3) != expected ||
+		    P.multiply(m, multiplication_policy::WNAF, 40) != P * m ||
+		    WeierstrassPoint<F>::linear_combination(n, P, m, P * 3) != P * (n + 3 * m) ||
+		    WeierstrassPoint<F>::linear_combination(-m, P, n, P) != P * (n - m))
+			++failures;
+	}
+
+	std::cout << name << " scalar multiplication matched affine double and add in " << (tries - failures) << " of " << tries << " rounds\n";
+	return failures == 0;
+}
+
+/* Cross-checks the x-only Montgomery arithmetic against the Weierstrass
+   model of random Montgomery curves, and the conversion back from the
+   Weierstrass curve and its point of order two.  */
+template<typename F>
+bool test_montgomery(const char *name) {
+	const Z& p = Fp751::modulus();
+	int tries = 20, failures = 0;
+
+	for (int i = 0; i < tries; ++i) {
+		MontgomeryCurvePtr<F> model = std::make_shared<MontgomeryCurve<F>>(
+			F(p, random_z_below(p), random_z_below(p)), F(p, random_z_below(p), random_z_below(p)));
+		WeierstrassCurvePtr<F> curve = model->to_weierstrass();
+		MontgomeryCurveHandle<F> M(model);
+		WeierstrassCurveHandle<F> E(curve);
+
+		WeierstrassPoint<F> P(E, F(p, random_z_below(p), random_z_below(p))), Q;
+		do {
+			Q = WeierstrassPoint<F>(E, F(p, random_z_below(p), random_z_below(p)));
+		} while (!Q.curve());
+		if (!P.curve()) {
+			--i;
+			continue;
+		}
+
+		Z n = random_z(random_u32_below(400) + 1);
+		MontgomeryPoint<F> xP(M, P), xQ(M, Q), xPmQ(M, P - Q), x2P(xP), xPpQ(xQ);
+		MontgomeryPoint<F>::double_add(x2P, xPpQ, xPmQ);
+
+		WeierstrassPoint<F> nP = P * n, back = (xP * n).to_weierstrass(E);
+		bool ok = xP * n == MontgomeryPoint<F>(M, nP) &&
+			  x2P == MontgomeryPoint<F>(M, P + P) &&
+			  xPpQ == MontgomeryPoint<F>(M, P + Q) &&
+			  MontgomeryPoint<F>(xP).triple_inplace() == MontgomeryPoint<F>(M, P * 3) &&
+			  MontgomeryPoint<F>::three_point_ladder(xP, xQ, xPmQ, n) == MontgomeryPoint<F>(M, P + Q * n) &&
+			  (back == nP || back == -nP);
+
+		/* u = 0 is the point (A/3B, 0) of order two on the Weierstrass model */
+		WeierstrassPoint<F> T(E, M->get_A() / (3 * M->get_B()), F(p));
+		MontgomeryCurvePtr<F> N = MontgomeryCurve<F>::from_weierstrass(T);
+		if (N) {
+			WeierstrassCurvePtr<F> E2 = N->to_weierstrass();
+			back = MontgomeryPoint<F>(MontgomeryCurveHandle<F>(N), P).to_weierstrass(E);
+			ok = ok && N->j_invariant() == M->j_invariant() &&
+			     E2->serialize() == E->serialize() && (back == P || back == -P);
+		}
+
+		if (!ok)
+			++failures;
+	}
+
+	std::cout << name << " x-only Montgomery arithmetic matched Weierstrass in " << (tries - failures) << " of " << tries << " rounds\n";
+	return failures == 0;
+}
+
+bool test_reduction() {
+	using namespace std::chrono;
+	const Z& p = Fp751::modulus();
+	const SpecialModulus *red = SpecialModulus::add(p);
+	int tries = 1000, failures = 0;
+
+	if (!red) {
+		std::cout << "special reduction was not selected for p751\n";
+		return false;
+	}
+
+	Z pm1 = p - 1;
+	for (int i = 0; i < tries; ++i) {
+		Z a = random_z_below(p), b = random_z_below(p);
+		/* the products of reduced values and anything shorter must take
+		   the special path, longer values fall back to mpz_mod */
+		Z values[] = { a * b, 3 * a * b, -(a * b), pm1 * pm1, (a + p) * (b + p), a, a + p, Z(i), p, 2 * p,
+			       a * b * b, -(pm1 * pm1 * pm1) };
+		const std::size_t special = 10;
+
+		for (const Z& x : values) {
+			Z expected = x, computed = x;
+			expected %= p;
+			if (red->reduce(computed) != (&x < values + special) || expected != computed) {
+				std::cout << "special reduction failed for " << x << "\n";
+				++failures;
+				break;
+			}
+		}
+	}
+
+	std::cout << "special reduction matched mpz_mod in " << (tries - failures) << " of " << tries << " rounds\n";
+
+	/* the products of the field multiplication, by both reductions */
+	std::vector<Z> products, reduced(tries);
+	for (int i = 0; i < tries; ++i)
+		products.push_back(random_z_below(p) * random_z_below(p));
+
+	double special = 0, generic = 0;
+	for (int r = 0; r < 5; ++r) {
+		auto start = steady_clock::now();
+		for (int i = 0; i < tries; ++i) {
+			reduced[i] = products[i];
+			red->reduce(reduced[i]);
+		}
+		auto middle = steady_clock::now();
+		for (int i = 0; i < tries; ++i)
+			::mpz_mod(reduced[i].get_mpz_t(), products[i].get_mpz_t(), p.get_mpz_t());
+		auto end = steady_clock::now();
+
+		double s = duration_cast<duration<double, std::nano>>(middle - start).count() / tries;
+		double g = duration_cast<duration<double, std::nano>>(end - middle).count() / tries;
+		special = r ? std::min(special, s) : s;
+		generic = r ? std::min(generic, g) : g;
+	}
+	std::cout << "reduction of a product: special " << special << " ns, mpz_mod " << generic << " ns\n";
+
+	return failures == 0;
+}
+
+/* Runs key exchanges in several threads at once, each of them starting
+   with the one-time initialization of sidh_params, to catch shared state in
+   the arithmetic.  Then again with the isogeny walks spread over a pool,
+   which the concurrent walks mostly find busy, and single exchanges of
+   both engines with and without the pool.  */
+bool test_threads() {
+	using namespace std::chrono;
+	typedef sidh_key_basic::engine engine;
+	const int threads = 4, exchanges = 2;
+	std::atomic<int> failures(0);
+
+	auto concurrent = [&failures, threads, exchanges](const char *name) {
+		std::vector<std::thread> workers;
+		int before = failures;
+
+		for (int i = 0; i < threads; ++i) {
+			workers.emplace_back([&failures, exchanges]() {
+				for (int j = 0; j < exchanges; ++j) {
+					kex_sidhex server(kex::mode::SERVER), client(kex::mode::CLIENT);
+					std::string server_public = server.init(), client_public = client.init();
+					std::string server_secret = server.fini(client_public);
+					std::string client_secret = client.fini(server_public);
+
+					if (server_secret.empty() || server_secret != client_secret)
+						++failures;
+				}
+			});
+		}
+
+		for (auto& worker : workers)
+			worker.join();
+
+		std::cout << "concurrent key exchanges" << name << ": " << (threads * exchanges - (failures - before)) << " of "
+			  << (threads * exchanges) << " in " << threads << " threads agreed\n";
+	};
+
+	auto single = [&failures, exchanges](engine e) {
+		auto start = steady_clock::now();
+		for (int j = 0; j < exchanges; ++j) {
+			sidh_key_basic key_a(sidh_params(sidh_params::side::A)), key_b(sidh_params(sidh_params::side::B));
+			key_a.set_engine(e);
+			key_b.set_engine(e);
+			key_a.generate();
+			key_b.generate();
+
+			std::string secret_a = key_a.compute_shared_secret(key_b);
+			if (secret_a.empty() || secret_a != key_b.compute_shared_secret(key_a))
+				++failures;
+		}
+		return duration_cast<duration<double, std::milli>>(steady_clock::now() - start).count() / exchanges;
+	};
+
+	concurrent("");
+
+	double serial[] = { single(engine::WEIERSTRASS), single(engine::MONTGOMERY) };
+
+	thread_pool::set_isogeny_pool(std::make_shared<thread_pool>(threads, 1));
+	concurrent(" with an isogeny pool");
+	double pooled[] = { single(engine::WEIERSTRASS), single(engine::MONTGOMERY) };
+	thread_pool::set_isogeny_pool(nullptr);
+
+	std::cout << "single key exchange, serial and with " << threads << " pool threads, of "
+		  << std::thread::hardware_concurrency() << " cores: weierstrass "
+		  << static_cast<long>(serial[0]) << " and " << static_cast<long>(pooled[0]) << " ms, montgomery "
+		  << static_cast<long>(serial[1]) << " and " << static_cast<long>(pooled[1]) << " ms\n";
+
+	return failures == 0;
+}
+
+/* Counters of the heap allocations done by GMP and by operator new, used
+   to see how many temporaries an operation creates.  */
+static std::atomic<std::size_t> gmp_allocations(0), new_allocations(0);
+
+static void *counting_gmp_alloc(size_t size) {
+	++gmp_allocations;
+	return std::malloc(size);
+}
+
+static void *counting_gmp_realloc(void *ptr, size_t, size_t size) {
+	++gmp_allocations;
+	return std::realloc(ptr, size);
+}
+
+static void counting_gmp_free(void *ptr, size_t) {
+	std::free(ptr);
+}
+
+void *operator new(std::size_t size) {
+	++new_allocations;
+	void *res = std::malloc(size ? size : 1);
+	if (!res)
+		throw std::bad_alloc();
+	return res;
+}
+
+void operator delete(void *ptr) noexcept {
+	std::free(ptr);
+}
+
+template<typename F>
+void count_allocations(const char *name) {
+	const Z& p = Fp751::modulus();
+	const int repeats = 100;
+	WeierstrassCurvePtr<F> E = std::make_shared<WeierstrassCurve<F>>(F(p, 1), F(p, 0));
+	std::vector<WeierstrassPoint<F>> points;
+
+	for (int x = 2; points.size() < 2; ++x) {
+		WeierstrassPoint<F> P(WeierstrassCurveHandle<F>(E), F(p, x, 1));
+		if (P.curve())
+			points.push_back(P);
+	}
+
+	const WeierstrassPoint<F> &P = points[0], &Q = points[1];
+	WeierstrassPoint<F> R;
+
+	mp_set_memory_functions(counting_gmp_alloc, counting_gmp_realloc, counting_gmp_free);
+	gmp_allocations = 0;
+	new_allocations = 0;
+
+	for (int i = 0; i < repeats; ++i)
+		R = P + Q;
+	std::size_t add_gmp = gmp_allocations, add_new = new_allocations;
+
+	gmp_allocations = 0;
+	new_allocations = 0;
+	for (int i = 0; i < repeats; ++i)
+		R = P + P;
+	std::size_t dbl_gmp = gmp_allocations, dbl_new = new_allocations;
+
+	/* the ladders, counted per bit of the scalar */
+	MontgomeryCurvePtr<F> M = std::make_shared<MontgomeryCurve<F>>(F(p, 6), F(p, 1));
+	MontgomeryPoint<F> xP(MontgomeryCurveHandle<F>(M), F(p, 2, 1), F(p, 1)), xR;
+	Z n = p >> 2;
+	std::size_t bits = n.bit_length();
+
+	gmp_allocations = 0;
+	new_allocations = 0;
+	R = P * n;
+	double mul_gmp = double(gmp_allocations) / bits, mul_new = double(new_allocations) / bits;
+
+	gmp_allocations = 0;
+	new_allocations = 0;
+	xR = xP * n;
+	double ladder_gmp = double(gmp_allocations) / bits, ladder_new = double(new_allocations) / bits;
+
+	mp_set_memory_functions(nullptr, nullptr, nullptr);
+
+	std::cout << name << " WeierstrassPoint::operator+ allocations per call: "
+		  << "addition " << add_gmp / repeats << " mpz + " << add_new / repeats << " new, "
+		  << "doubling " << dbl_gmp / repeats << " mpz + " << dbl_new / repeats << " new\n";
+	std::cout << name << " allocations per bit: "
+		  << "WeierstrassPoint::operator* " << mul_gmp << " mpz + " << mul_new << " new, "
+		  << "MontgomeryPoint::operator* " << ladder_gmp << " mpz + " << ladder_new << " new\n";
+	std::cout << name << " sizeof WeierstrassPoint " << sizeof(WeierstrassPoint<F>)
+		  << ", MontgomeryPoint " << sizeof(MontgomeryPoint<F>) << " bytes\n";
+}
+
+template<typename F>
+void time_sqrt(const char *name) {
+	using namespace std::chrono;
+	const Z& p = Fp751::modulus();
+	const int repeats = 200;
+	std::vector<F> values;
+	int squares = 0;
+
+	for (int i = 0; i < repeats; ++i)
+		values.push_back(F(p, random_z_below(p), random_z_below(p)));
+
+	auto start = steady_clock::now();
+	for (const F& x : values)
+		squares += x.is_square();
+	auto mid = steady_clock::now();
+	for (F& x : values)
+		x.square_inplace().sqrt();
+	auto end = steady_clock::now();
+
+	std::cout << name << " is_square " << duration_cast<microseconds>(mid - start).count() / repeats << " µs, "
+		  << "sqrt " << duration_cast<microseconds>(end - mid).count() / repeats << " µs per call "
+		  << "(" << squares << " of " << repeats << " were squares)\n";
+}
+
 void measure(const std::string& str, int repeats, std::function<void()> f) {
 	using namespace std::chrono;
 	auto start = steady_clock::now();
@@ -51,12 +492,13 @@ void generate_mn_alternative(Z& m, Z& n, const Z& le, int l)
 	n = 1;
 }
 
+template<typename F>
 void measure_time(
 	std::function<void(Z&, Z&, const Z&, int)> mn_generator,
-	WeierstrassPoint& Pa,
-	WeierstrassPoint& Qa,
-	WeierstrassPoint& Pb,
-	WeierstrassPoint& Qb,
+	WeierstrassPoint<F>& Pa,
+	WeierstrassPoint<F>& Qa,
+	WeierstrassPoint<F>& Pb,
+	WeierstrassPoint<F>& Qb,
 	Z& lea,
 	int la,
 	int ea,
@@ -71,36 +513,64 @@ void measure_time(
 	mn_generator(ma, na, lea, la);
 	mn_generator(mb, nb, leb, lb);
 
-	WeierstrassPoint gen_a = ma*Pa + na*Qa, gen_b = mb*Pb + nb*Qb;
+	WeierstrassPoint<F> gen_a = ma*Pa + na*Qa, gen_b = mb*Pb + nb*Qb;
 
 	measure("A without strategy", 1, [&gen_a, la, ea, &Pb, &Qb]() {
-		WeierstrassIsogeny iso_a(gen_a, la, ea);
+		WeierstrassIsogeny<F> iso_a(gen_a, la, ea);
 		iso_a(Pb);
 		iso_a(Qb);
 	});
 	measure("B without strategy", 1, [&gen_b, lb, eb, &Pa, &Qa]() {
-		WeierstrassIsogeny iso_b(gen_b, lb, eb);
+		WeierstrassIsogeny<F> iso_b(gen_b, lb, eb);
 		iso_b(Pa);
 		iso_b(Qa);
 	});
 	measure("A with strategy", 10, [&gen_a, la, ea, &Pb, &Qb, &strategy]() {
-		WeierstrassIsogeny iso_a(gen_a, la, ea, strategy);
+		WeierstrassIsogeny<F> iso_a(gen_a, la, ea, strategy);
 		iso_a(Pb);
 		iso_a(Qb);
 	});
 	measure("B with strategy", 10, [&gen_b, lb, eb, &Pa, &Qa, &strategy]() {
-		WeierstrassIsogeny iso_b(gen_b, lb, eb, strategy);
+		WeierstrassIsogeny<F> iso_b(gen_b, lb, eb, strategy);
 		iso_b(Pa);
 		iso_b(Qa);
 	});
+	measure("A Weil pairing", 3, [&Pa, &Qa, &lea]() {
+		Pa.weil_pairing(Qa, lea);
+	});
+	measure("A Tate pairing", 3, [&Pa, &Qa, &lea]() {
+		Pa.tate_pairing(Qa, lea);
+	});
+	measure("B Weil pairing", 3, [&Pb, &Qb, &leb]() {
+		Pb.weil_pairing(Qb, leb);
+	});
+	measure("B Tate pairing", 3, [&Pb, &Qb, &leb]() {
+		Pb.tate_pairing(Qb, leb);
+	});
+	measure("A basis by double and add", 3, [&Pa, la, ea, lb, eb]() {
+		Pa.curve()->basis(la, ea, lb, eb, 1, multiplication_policy::DOUBLE_AND_ADD);
+	});
+	measure("A basis by wNAF", 3, [&Pa, la, ea, lb, eb]() {
+		Pa.curve()->basis(la, ea, lb, eb, 1, multiplication_policy::WNAF);
+	});
+	measure("B basis by wNAF", 3, [&Pb, la, ea, lb, eb]() {
+		Pb.curve()->basis(lb, eb, la, ea, 1, multiplication_policy::WNAF);
+	});
+	measure("A deterministic basis", 3, [&Pa, la, ea, lb, eb]() {
+		Pa.curve()->deterministic_basis(la, ea, lb, eb, 1);
+	});
+	measure("B deterministic basis", 3, [&Pb, la, ea, lb, eb]() {
+		Pb.curve()->deterministic_basis(lb, eb, la, ea, 1);
+	});
 }
 
+template<typename F>
 void check_order(
 	std::function<void(Z&, Z&, const Z&, int)> mn_generator,
-	WeierstrassPoint& Pa,
-	WeierstrassPoint& Qa,
-	WeierstrassPoint& Pb,
-	WeierstrassPoint& Qb,
+	WeierstrassPoint<F>& Pa,
+	WeierstrassPoint<F>& Qa,
+	WeierstrassPoint<F>& Pb,
+	WeierstrassPoint<F>& Qb,
 	Z& lea,
 	int la,
 	int ea,
@@ -114,7 +584,7 @@ void check_order(
 	mn_generator(ma, na, lea, la);
 	mn_generator(mb, nb, leb, lb);
 
-	WeierstrassPoint gen_a = ma*Pa + na*Qa, gen_b = mb*Pb + nb*Qb;
+	WeierstrassPoint<F> gen_a = ma*Pa + na*Qa, gen_b = mb*Pb + nb*Qb;
 
 	Z base(1), mul(la);
 	for (int i = 0; i <= ea; ++i) {
@@ -140,12 +610,13 @@ void check_order(
 	}
 }
 
+template<typename F>
 bool compare_j_invariants(
 	std::function<void(Z&, Z&, const Z&, int)> mn_generator,
-	WeierstrassPoint& Pa,
-	WeierstrassPoint& Qa,
-	WeierstrassPoint& Pb,
-	WeierstrassPoint& Qb,
+	WeierstrassPoint<F>& Pa,
+	WeierstrassPoint<F>& Qa,
+	WeierstrassPoint<F>& Pb,
+	WeierstrassPoint<F>& Qb,
 	Z& lea,
 	int la,
 	int ea,
@@ -160,27 +631,74 @@ bool compare_j_invariants(
 	mn_generator(ma, na, lea, la);
 	mn_generator(mb, nb, leb, lb);
 
-	WeierstrassPoint gen_a = ma*Pa + na*Qa, gen_b = mb*Pb + nb*Qb;
+	WeierstrassPoint<F> gen_a = ma*Pa + na*Qa, gen_b = mb*Pb + nb*Qb;
 
-	WeierstrassIsogeny iso_a(gen_a, la, ea, strategy);
-	WeierstrassIsogeny iso_b(gen_b, lb, eb, strategy);
+	WeierstrassIsogeny<F> iso_a(gen_a, la, ea, strategy);
+	WeierstrassIsogeny<F> iso_b(gen_b, lb, eb, strategy);
 
-	WeierstrassPoint gen_ab = ma*iso_b(Pa) + na*iso_b(Qa);
-	WeierstrassPoint gen_ba = mb*iso_a(Pb) + nb*iso_a(Qb);
+	WeierstrassPoint<F> gen_ab = ma*iso_b(Pa) + na*iso_b(Qa);
+	WeierstrassPoint<F> gen_ba = mb*iso_a(Pb) + nb*iso_a(Qb);
 
-	WeierstrassIsogeny iso_ab(gen_ab, la, ea, strategy);
-	WeierstrassIsogeny iso_ba(gen_ba, lb, eb, strategy);
+	WeierstrassIsogeny<F> iso_ab(gen_ab, la, ea, strategy);
+	WeierstrassIsogeny<F> iso_ba(gen_ba, lb, eb, strategy);
 
 	return iso_ab.image()->j_invariant() == iso_ba.image()->j_invariant();
 }
 
+/* The isogeny of degree l with kernel generated by cofactor·P maps the
+   kernel to the identity, P and Q onto the image and sums to sums.  */
+template<typename F>
+bool check_small_isogeny(const Z& p, const WeierstrassPoint<F>& P, const WeierstrassPoint<F>& Q, const Z& cofactor, int l)
+{
+	WeierstrassPoint<F> G = P * cofactor;
+	WeierstrassCurve<F> image(p);
+	WeierstrassSmallIsogeny<F> phi = P.curve()->small_isogeny(G, l, image);
+
+	WeierstrassPoint<F> R = phi(P), S = phi(Q);
+
+	return phi(G).is_identity() && R.check() && S.check() && R + S == phi(P + Q);
+}
+
+/* The pairings of a basis of the n-torsion are bilinear, the Tate one
+   agrees with the Weil one through e^((p² - 1)/n) = t(P, Q)/t(Q, P) and
+   both have order n exactly.  */
+template<typename F>
+bool check_pairings(const Z& p, const WeierstrassPoint<F>& P, const WeierstrassPoint<F>& Q, const Z& n, const Z& n_div_l)
+{
+	F e = P.weil_pairing(Q, n), t = P.tate_pairing(Q, n);
+
+	return (P * 5).weil_pairing(Q * 7, n) == e.pow(Z(35)) && (P * 5).tate_pairing(Q * 7, n) == t.pow(Z(35))
+		&& e.pow(Z((p*p - 1) / n)) == t / Q.tate_pairing(P, n)
+		&& e.pow(n_div_l) != 1 && t.pow(n_div_l) != 1 && P.tate_pairing(P * 3, n) == 1;
+}
+
+/* Mapping an array through an isogeny at once, or streaming it along the
+   walk, gives the same points as mapping them one by one */
+template<typename F>
+bool check_batch_evaluation(const WeierstrassPoint<F>& generator, int l, int e, const std::vector<int>& strategy,
+			    const WeierstrassPoint<F>& P, const WeierstrassPoint<F>& Q)
+{
+	WeierstrassIsogeny<F> iso(generator, l, e, strategy);
+	WeierstrassPoint<F> points[] = { P, Q, P + Q, WeierstrassPoint<F>(P.curve()), generator };
+	WeierstrassPoint<F> streamed[] = { P, Q };
+
+	iso.evaluate(points, points + 5);
+	WeierstrassIsogeny<F> stream(generator, l, e, strategy, streamed, streamed + 2);
+
+	return points[0] == iso(P) && points[1] == iso(Q) && points[2] == points[0] + points[1]
+		&& points[3].is_identity() && points[4].is_identity() && points[0].curve().get() == iso.image().get()
+		&& streamed[0] == points[0] && streamed[1] == points[1] && streamed[0].curve().get() == stream.image().get()
+		&& stream.isogenies().empty() && stream.image()->j_invariant() == iso.image()->j_invariant();
+}
+
+template<typename F>
 void test_weierstrass () {
 	sidh_params params(sidh_params::side::A);
 	std::vector<int> strategy = params.strategy;
 
 	const Z &p = params.prime;
 
-	WeierstrassCurvePtr E = std::make_shared<WeierstrassCurve>(GF(p, 1), GF(p, 0));
+	WeierstrassCurvePtr<F> E = std::make_shared<WeierstrassCurve<F>>(F(p, 1), F(p, 0));
 
 	int la = 2, lb = 3, ea = 372, eb = 239, f = 1;
 
@@ -207,6 +725,39 @@ void test_weierstrass () {
 		check_order(generate_mn_alternative, Pa, Qa, Pb, Qb, lea, la, ea, leb, lb, eb);
 	}
 
+	// isogenies of small degree
+	if (true) {
+		std::cout << "Vélu isogenies of degree 2, 3, 4: "
+			  << (check_small_isogeny(p, Pa, Qa, lea / 2, 2) ? "T " : "F ")
+			  << (check_small_isogeny(p, Pb, Qb, leb / 3, 3) ? "T " : "F ")
+			  << (check_small_isogeny(p, Pa, Qa, lea / 4, 4) ? "T\n" : "F\n");
+	}
+
+	// pairings
+	if (true) {
+		std::cout << "Weil and Tate pairings: "
+			  << (check_pairings(p, Pa, Qa, lea, lea / la) ? "T " : "F ")
+			  << (check_pairings(p, Pb, Qb, leb, leb / lb) ? "T\n" : "F\n");
+	}
+
+	// deterministic basis
+	if (true) {
+		auto dPQa = E->deterministic_basis(la, ea, lb, eb, f), dPQb = E->deterministic_basis(lb, eb, la, ea, f);
+		auto again = E->deterministic_basis(la, ea, lb, eb, f);
+
+		std::cout << "deterministic basis: "
+			  << (check_pairings(p, dPQa.first, dPQa.second, lea, lea / la) ? "T " : "F ")
+			  << (check_pairings(p, dPQb.first, dPQb.second, leb, leb / lb) ? "T " : "F ")
+			  << (again == dPQa ? "T\n" : "F\n");
+	}
+
+	// batched evaluation
+	if (true) {
+		std::cout << "batched isogeny evaluation: "
+			  << (check_batch_evaluation(Pa, la, ea, strategy, Pb, Qb) ? "T " : "F ")
+			  << (check_batch_evaluation(Pb, lb, eb, strategy, Pa, Qa) ? "T\n" : "F\n");
+	}
+
 	// measure time
 	if (true)
 		measure_time(generate_mn, Pa, Qa, Pb, Qb, lea, la, ea, leb, lb, eb, strategy);
@@ -240,21 +791,21 @@ void test_weierstrass () {
 
 void test_serialization() {
 	Z p("3700444163740528325594401040305817124863");
-	WeierstrassCurvePtr curve = std::make_shared<WeierstrassCurve>(
+	WeierstrassCurvePtr<GF> curve = std::make_shared<WeierstrassCurve<GF>>(
 		GF(p, "2524646701852396349308425328218203569693", "2374093068336250774107936421407893885897"),
 		GF(p, "1309099413211767078055232768460483417201", "1944869260414574206229153243510104781725")
 	);
-	WeierstrassPoint identity(curve);
+	WeierstrassPoint<GF> identity{WeierstrassCurveHandle<GF>(curve)};
 
-	WeierstrassCurvePtr unserialized_curve = std::make_shared<WeierstrassCurve>(p);
+	WeierstrassCurvePtr<GF> unserialized_curve = std::make_shared<WeierstrassCurve<GF>>(p);
 	unserialized_curve->unserialize(curve->serialize());
 
 	std::cout << *curve << '\n';
 	curve->unserialize(curve->serialize());
 	std::cout << *curve << '\n';
 
-	WeierstrassPoint point(
-		curve,
+	WeierstrassPoint<GF> point(
+		WeierstrassCurveHandle<GF>(curve),
 		GF(p, "2524646701852396349308425328218203569693", "2374093068336250774107936421407893885897"),
 		GF(p, "1309099413211767078055232768460483417201", "1944869260414574206229153243510104781725")
 	);
@@ -270,6 +821,333 @@ void test_serialization() {
 	std::cout << point << '\n';
 }
 
+/* Public key export and import run on every handshake, so time them on
+   their own, without the isogeny computation.  */
+bool test_key_serialization() {
+	using namespace std::chrono;
+	const int repeats = 2000;
+	sidh_key_basic key(sidh_params(sidh_params::side::A)), imported(sidh_params(sidh_params::side::A));
+	key.generate();
+
+	/* short buffers, truncation and two's complement */
+	Z big = (Z(1) << 200) + 0x1234;
+	if (Z(5).serialize(0) != "" || Z(-1).serialize(3) != std::string(3, '\xff') ||
+	    Z(-256).serialize(2) != std::string("\0\xff", 2) || big.serialize(2) != "\x34\x12" ||
+	    Z(-big).serialize(2) != "\xcc\xed" || Z(0).serialize(2) != std::string(2, 0)) {
+		std::cout << "numbers were serialized wrong\n";
+		return false;
+	}
+
+	std::string exported_public = key.export_public(), exported_private = key.export_private();
+	if (!imported.import_public(exported_public) || imported.export_public() != exported_public ||
+	    !imported.import_private(exported_private) || imported.export_private() != exported_private) {
+		std::cout << "key did not survive export and import\n";
+		return false;
+	}
+
+	/* side A keys of earlier versions have scalars up to 2^373 */
+	sidh_params params_a(sidh_params::side::A);
+	Z n = random_z_below(params_a.le), legacy_n = n + params_a.le;
+	std::string legacy = std::string(1, 0) + legacy_n.serialize(params_a.le.size());
+	std::string reduced = std::string(1, 0) + n.serialize(params_a.le.size());
+	sidh_key_basic legacy_key(params_a), reduced_key(params_a);
+	if (!legacy_key.import_private(legacy) || !reduced_key.import_private(reduced) ||
+	    legacy_key.export_private() != reduced ||
+	    !legacy_key.generate_public() || !reduced_key.generate_public() || legacy_key.export_public() != reduced_key.export_public() ||
+	    legacy_key.import_private(std::string(1, 0) + Z(2 * legacy_n).serialize(params_a.le.size()))) {
+		std::cout << "private key of side A with a scalar above 2^372 was not imported as its reduction\n";
+		return false;
+	}
+
+	/* the tables built here are those of the bases, which import_tables
+	   takes on trust from the digest pinned for them */
+	sidh_params params_b(sidh_params::side::B);
+	auto precomputed = sidh_params::precomputed();
+	if (!precomputed->Pa.is_table_of(params_a.P) || !precomputed->Qa.is_table_of(params_a.Q) ||
+	    !precomputed->Pb.is_table_of(params_b.P) || !precomputed->Qb.is_table_of(params_b.Q) ||
+	    precomputed->Pa.is_table_of(params_a.Q) ||
+	    precomputed->Ta != params_a.P.multiply(params_a.lem1, multiplication_policy::WNAF) ||
+	    precomputed->Ua != params_a.Q.multiply(params_a.lem1, multiplication_policy::WNAF)) {
+		std::cout << "precomputed tables are not those of the bases\n";
+		return false;
+	}
+
+	std::string tables = sidh_params::export_tables();
+	auto import_start = steady_clock::now();
+	if (!sidh_params::import_tables(tables) || sidh_params::export_tables() != tables) {
+		std::cout << "precomputed tables did not survive export and import\n";
+		return false;
+	}
+	double import_ms = duration_cast<duration<double, std::milli>>(steady_clock::now() - import_start).count();
+
+	/* tables of other points of E: the combs of Pa and Qa swapped, Ta and
+	   Ua swapped, and a single bit flipped */
+	std::size_t comb = precomputed->Pa.size(), point = precomputed->Ta.size(), ts = tables.size() - 2 * point;
+	std::string swapped_combs = tables.substr(comb, comb) + tables.substr(0, comb) + tables.substr(2 * comb);
+	std::string swapped_points = tables.substr(0, ts) + tables.substr(ts + point) + tables.substr(ts, point);
+	std::string flipped = tables;
+	flipped[comb + 5] ^= 1;
+	if (sidh_params::import_tables(swapped_combs) || sidh_params::import_tables(swapped_points) ||
+	    sidh_params::import_tables(flipped) || sidh_params::export_tables() != tables) {
+		std::cout << "precomputed tables of other points were imported\n";
+		return false;
+	}
+
+	auto rate = [repeats](std::function<void()> f) {
+		auto start = steady_clock::now();
+		for (int i = 0; i < repeats; ++i)
+			f();
+		auto end = steady_clock::now();
+		return static_cast<long>(repeats / duration_cast<duration<double>>(end - start).count());
+	};
+
+	long public_export = rate([&]() { exported_public = key.export_public(); });
+	long public_import = rate([&]() { imported.import_public(exported_public); });
+	long private_export = rate([&]() { exported_private = key.export_private(); });
+	long private_import = rate([&]() { imported.import_private(exported_private); });
+
+	std::cout << "public keys of " << exported_public.size() << " bytes: "
+		  << public_export << " exported, " << public_import << " imported per second\n"
+		  << "private keys of " << exported_private.size() << " bytes: "
+		  << private_export << " exported, " << private_import << " imported per second\n"
+		  << "precomputed tables of " << tables.size() << " bytes imported in " << import_ms << " ms\n";
+	return true;
+}
+
+/* Key exchanges with each combination of isogeny engines on the two
+   sides, which all have to agree, and the time a whole exchange takes
+   when both sides use the same engine.  */
+bool test_engines() {
+	using namespace std::chrono;
+	typedef sidh_key_basic::engine engine;
+	const int exchanges = 4;
+	const engine engines[] = { engine::WEIERSTRASS, engine::MONTGOMERY };
+	const char *names[] = { "weierstrass", "montgomery" };
+	double elapsed[2] = {};
+	int failures = 0;
+
+	for (int i = 0; i < exchanges; ++i) {
+		for (int a = 0; a < 2; ++a) {
+			for (int b = 0; b < 2; ++b) {
+				sidh_key_basic key_a(sidh_params(sidh_params::side::A)), key_b(sidh_params(sidh_params::side::B));
+				key_a.set_engine(engines[a]);
+				key_b.set_engine(engines[b]);
+
+				auto start = steady_clock::now();
+				key_a.generate();
+				key_b.generate();
+				std::string secret_a = key_a.compute_shared_secret(key_b);
+				std::string secret_b = key_b.compute_shared_secret(key_a);
+				auto end = steady_clock::now();
+
+				if (a == b)
+					elapsed[a] += duration_cast<duration<double>>(end - start).count();
+
+				if (secret_a.empty() || secret_a != secret_b) {
+					std::cout << "secrets of " << names[a] << " side A and " << names[b] << " side B differ\n";
+					++failures;
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < 2; ++i)
+		std::cout << names[i] << " engine: " << static_cast<long>(elapsed[i] * 1000 / exchanges) << " ms per key exchange\n";
+	std::cout << "speedup " << (elapsed[0] / elapsed[1]) << "\n";
+
+	return failures == 0;
+}
+
+/* The multiplications by l on the left branches of a walk and the
+   evaluations of its steps at the points of the right ones */
+void strategy_counts(const std::vector<int>& strategy, int steps, long& muls, long& evals) {
+	std::vector<long> m(steps + 1, 0), e(steps + 1, 0);
+
+	for (int h = 2; h <= steps; ++h) {
+		int s = strategy[h];
+		m[h] = m[s] + m[h - s] + (h - s);
+		e[h] = e[s] + e[h - s] + s;
+	}
+
+	muls = m[steps];
+	evals = e[steps];
+}
+
+/* The numbers of steps of multiplication of the left branches of a walk */
+void left_branches(const std::vector<int>& strategy, int steps, std::vector<int>& lengths) {
+	if (steps < 2)
+		return;
+
+	int s = strategy[steps];
+	lengths.push_back(steps - s);
+	left_branches(strategy, s, lengths);
+	left_branches(strategy, steps - s, lengths);
+}
+
+/* The cost of a walk by the model of sidh_params::optimal_strategy */
+double strategy_cost(const std::vector<int>& strategy, int steps, const sidh_params::walk_cost& cost) {
+	long muls, evals;
+
+	strategy_counts(strategy, steps, muls, evals);
+	return muls * cost.mul + evals * cost.eval;
+}
+
+/* Key generation with the strategies for equal costs, which are the
+   balanced ones of the old fixed table, against the optimal ones for the
+   costs measured here, on the same private keys and the least of several
+   runs each.  The keys of the tuned strategies must agree.  */
+bool test_strategies() {
+	using namespace std::chrono;
+	typedef sidh_key_basic::engine engine;
+	const int rounds = 15;
+	const engine engines[] = { engine::WEIERSTRASS, engine::MONTGOMERY };
+	const char *names[] = { "weierstrass", "montgomery" };
+	sidh_params::costs balanced, measured = sidh_params::measure_costs();
+	double elapsed[2][2] = {}, predicted[2][2] = {};
+	int failures = 0;
+
+	balanced.weierstrass[0] = balanced.weierstrass[1] = { 1, 1 };
+	balanced.montgomery[0] = balanced.montgomery[1] = { 1, 1 };
+
+	for (int i = 0; i < 2; ++i) {
+		const sidh_params::walk_cost *walks[] = { &measured.weierstrass[i], &measured.montgomery[i] };
+		int steps[] = { i ? 239 : 372, i ? 239 : 186 };
+
+		std::cout << "side " << "AB"[i] << " costs in µs, multiplication and evaluation:";
+		for (int e = 0; e < 2; ++e) {
+			const sidh_params::walk_cost& cost = *walks[e];
+			double before = strategy_cost(sidh_params::optimal_strategy(steps[e], balanced.weierstrass[0]), steps[e], cost);
+			double after = strategy_cost(sidh_params::optimal_strategy(steps[e], cost), steps[e], cost);
+
+			predicted[e][0] += before;
+			predicted[e][1] += after;
+			std::cout << " " << names[e] << " " << cost.mul << ", " << cost.eval
+				  << " (walk " << static_cast<long>(before) << " -> " << static_cast<long>(after) << " µs, "
+				  << 100 * (before - after) / before << "% less)";
+		}
+		std::cout << "\n";
+
+		std::cout << "side " << "AB"[i] << " tuned walks, left branches and evaluations:";
+		for (int e = 0; e < 2; ++e) {
+			const sidh_params::walk_cost& cost = *walks[e];
+			long muls, evals;
+
+			strategy_counts(sidh_params::optimal_strategy(steps[e], cost), steps[e], muls, evals);
+			std::cout << " " << names[e] << " " << muls << " × " << cost.mul << " = " << static_cast<long>(muls * cost.mul)
+				  << " µs, " << evals << " × " << cost.eval << " = " << static_cast<long>(evals * cost.eval) << " µs";
+		}
+		std::cout << "\n";
+	}
+
+	/* The multiplications of the left branches of the Weierstrass walks,
+	   each of its length, by the dedicated kernels against the doublings
+	   and additions they replace, the least of a few runs each */
+	{
+		const int repeats = 3;
+
+		for (int l = 2; l <= 3; ++l) {
+			sidh_params params(l == 2 ? sidh_params::side::A : sidh_params::side::B);
+			std::vector<int> lengths;
+			double generic = 0, kernel = 0;
+			long steps = 0;
+
+			left_branches(params.strategy, params.e, lengths);
+			for (int length : lengths)
+				steps += length;
+
+			for (int r = 0; r < repeats; ++r) {
+				auto start = steady_clock::now();
+				for (int length : lengths) {
+					WeierstrassJacobianPoint<GF751> Q(params.P);
+					for (int j = 0; j < length; ++j) {
+						WeierstrassJacobianPoint<GF751> S(Q);
+						Q.double_inplace();
+						if (l == 3)
+							Q += S;
+					}
+				}
+				auto middle = steady_clock::now();
+				for (int length : lengths) {
+					WeierstrassJacobianPoint<GF751> P(params.P);
+					P.multiply_by_power_inplace(l, length);
+				}
+				auto end = steady_clock::now();
+
+				double g = duration_cast<duration<double, std::micro>>(middle - start).count();
+				double k = duration_cast<duration<double, std::micro>>(end - middle).count();
+				generic = r ? std::min(generic, g) : g;
+				kernel = r ? std::min(kernel, k) : k;
+			}
+
+			std::cout << "multiplication by " << l << " on " << lengths.size() << " left branches of "
+				  << steps / static_cast<double>(lengths.size()) << " steps on average: generic "
+				  << generic / steps << " µs, kernel " << kernel / steps << " µs per step\n";
+		}
+	}
+
+	sidh_key_basic private_a(sidh_params(sidh_params::side::A)), private_b(sidh_params(sidh_params::side::B));
+	private_a.generate_private();
+	private_b.generate_private();
+	std::string exported_a = private_a.export_private(), exported_b = private_b.export_private();
+
+	for (int e = 0; e < 2; ++e) {
+		std::string secrets[2];
+
+		/* in turn first, so that neither gains from a warm cache */
+		for (int r = 0; r < rounds; ++r) {
+			for (int k = 0; k < 2; ++k) {
+				int tuned = (r + k) % 2;
+				sidh_params::set_costs(tuned ? measured : balanced);
+
+				sidh_key_basic key_a(sidh_params(sidh_params::side::A)), key_b(sidh_params(sidh_params::side::B));
+				key_a.set_engine(engines[e]);
+				key_b.set_engine(engines[e]);
+				key_a.import_private(exported_a);
+				key_b.import_private(exported_b);
+
+				auto start = steady_clock::now();
+				key_a.generate_public();
+				key_b.generate_public();
+				double t = duration_cast<duration<double>>(steady_clock::now() - start).count();
+				elapsed[e][tuned] = r ? std::min(elapsed[e][tuned], t) : t;
+
+				if (r < 2) {
+					secrets[tuned] = key_a.compute_shared_secret(key_b);
+					if (secrets[tuned].empty() || secrets[tuned] != key_b.compute_shared_secret(key_a)) {
+						std::cout << names[e] << " secrets differ\n";
+						++failures;
+					}
+				}
+			}
+		}
+
+		if (secrets[0] != secrets[1]) {
+			std::cout << names[e] << " secrets of the balanced and tuned strategies differ\n";
+			++failures;
+		}
+	}
+
+	sidh_params::set_costs(sidh_params::default_costs());
+
+	/* differences within 5% are the noise of the timing */
+	for (int e = 0; e < 2; ++e) {
+		double speedup = elapsed[e][0] / elapsed[e][1];
+		double gain = 100 * (predicted[e][0] - predicted[e][1]) / predicted[e][0];
+
+		std::cout << names[e] << " key generation: balanced " << elapsed[e][0] * 1000
+			  << " ms, tuned " << elapsed[e][1] * 1000 << " ms, speedup " << speedup
+			  << ", the cost model predicts " << gain << "% less\n";
+		if (speedup < 0.95)
+			std::cout << names[e] << " tuned strategies are " << 100 * (1 / speedup - 1) << "% slower on this machine\n";
+		else if (speedup > 1.05)
+			std::cout << names[e] << " tuned strategies are " << 100 * (1 - 1 / speedup) << "% faster on this machine\n";
+		else
+			std::cout << names[e] << " tuned and balanced strategies are equivalent on this machine\n";
+	}
+
+	return failures == 0;
+}
+
 #ifdef HAVE_MSR_SIDH
 #define _AMD64_
 #define __LINUX__
@@ -284,15 +1162,16 @@ CRYPTO_STATUS random_bytes_for_msr(unsigned int n, unsigned char* o)
 typedef CRYPTO_STATUS (*KeyGeneration_t)(unsigned char*, unsigned char*, PCurveIsogenyStruct);
 typedef CRYPTO_STATUS (*SecretAgreement_t)(unsigned char*, unsigned char*, unsigned char*, PCurveIsogenyStruct);
 
-void keygen_libpqc(const sidh_params& params, Z *om, Z *on, WeierstrassPoint *oiso_P_peer, WeierstrassPoint *oiso_Q_peer)
+/* Returns the image curve, which has to be kept for the mapped points */
+WeierstrassCurvePtr<GF751> keygen_libpqc(const sidh_params& params, Z *om, Z *on, WeierstrassPoint<GF751> *oiso_P_peer, WeierstrassPoint<GF751> *oiso_Q_peer)
 {
 	Z m, n;
 	generate_mn(m, n, params.le, params.l);
-	WeierstrassPoint gen = m*params.P + n*params.Q;
-	WeierstrassIsogeny iso(gen, params.l, params.e, params.strategy);
+	WeierstrassPoint<GF751> gen = m*params.P + n*params.Q;
+	WeierstrassIsogeny<GF751> iso(gen, params.l, params.e, params.strategy);
 
-	WeierstrassPoint iso_P_peer = iso(params.P_peer);
-	WeierstrassPoint iso_Q_peer = iso(params.Q_peer);
+	WeierstrassPoint<GF751> iso_P_peer = iso(params.P_peer);
+	WeierstrassPoint<GF751> iso_Q_peer = iso(params.Q_peer);
 
 	if (om)
 		*om = m;
@@ -302,6 +1181,7 @@ void keygen_libpqc(const sidh_params& params, Z *om, Z *on, WeierstrassPoint *oi
 		*oiso_P_peer = iso_P_peer;
 	if (oiso_Q_peer)
 		*oiso_Q_peer = iso_Q_peer;
+	return iso.image();
 }
 
 void keygen_sidhlib(KeyGeneration_t KeyGeneration_X, unsigned char *opriv, unsigned char *opub)
@@ -318,10 +1198,10 @@ void keygen_sidhlib(KeyGeneration_t KeyGeneration_X, unsigned char *opriv, unsig
 		::memcpy(opub, pub, 4*2*psize);
 }
 
-void final_libpqc(const sidh_params& params, const Z& m, const Z& n, const WeierstrassPoint& iso_P, const WeierstrassPoint& iso_Q)
+void final_libpqc(const sidh_params& params, const Z& m, const Z& n, const WeierstrassPoint<GF751>& iso_P, const WeierstrassPoint<GF751>& iso_Q)
 {
-	WeierstrassPoint gen = m*iso_P + n*iso_Q;
-	WeierstrassIsogeny iso(gen, params.l, params.e, params.strategy);
+	WeierstrassPoint<GF751> gen = m*iso_P + n*iso_Q;
+	WeierstrassIsogeny<GF751> iso(gen, params.l, params.e, params.strategy);
 	iso.image()->j_invariant();
 }
 
@@ -366,9 +1246,9 @@ void test_msr_sidh()
 	unsigned char privA[osize], privB[osize], pubA[4*2*psize], pubB[4*2*psize];
 
 	Z ma, na, mb, nb;
-	WeierstrassPoint iso_PA, iso_QA, iso_PB, iso_QB;
-	keygen_libpqc(paramsA, &ma, &na, &iso_PB, &iso_QB);
-	keygen_libpqc(paramsB, &mb, &nb, &iso_PA, &iso_QA);
+	WeierstrassPoint<GF751> iso_PA, iso_QA, iso_PB, iso_QB;
+	WeierstrassCurvePtr<GF751> EA = keygen_libpqc(paramsA, &ma, &na, &iso_PB, &iso_QB);
+	WeierstrassCurvePtr<GF751> EB = keygen_libpqc(paramsB, &mb, &nb, &iso_PA, &iso_QA);
 
 	keygen_sidhlib(KeyGeneration_A, privA, pubA);
 	keygen_sidhlib(KeyGeneration_B, privB, pubB);
@@ -397,7 +1277,7 @@ void test_msr_sidh()
 
 int usage()
 {
-	std::cerr << "usage: pqc-tests [squaring|serialization|weierstrass";
+	std::cerr << "usage: pqc-tests [squaring|serialization|key-serialization|fp751|reduction|batch-invert|scalar-mul|montgomery|threads|allocations|sqrt|weierstrass|weierstrass-gf|engines|strategies";
 #ifdef HAVE_MSR_SIDH
 	std::cerr << "|msr-sidh";
 #endif /* HAVE_MSR_SIDH */
@@ -406,15 +1286,39 @@ int usage()
 }
 
 int main (int argc, char ** argv) {
-	bool squaring = false, serialization = false, weierstrass = false, msr_sidh = false;
+	bool squaring = false, serialization = false, key_serialization = false, fp751 = false, reduction = false, batch_invert = false, scalar_mul = false, montgomery = false, threads = false, allocations = false, sqrt = false, weierstrass = false, weierstrass_gf = false, engines = false, strategies = false, msr_sidh = false;
 
 	for (int i = 1; i < argc; ++i) {
 		if (!strcasecmp(argv[i], "squaring"))
 			squaring = true;
 		else if (!strcasecmp(argv[i], "serialization"))
 			serialization = true;
+		else if (!strcasecmp(argv[i], "key-serialization"))
+			key_serialization = true;
+		else if (!strcasecmp(argv[i], "fp751"))
+			fp751 = true;
+		else if (!strcasecmp(argv[i], "reduction"))
+			reduction = true;
+		else if (!strcasecmp(argv[i], "batch-invert"))
+			batch_invert = true;
+		else if (!strcasecmp(argv[i], "scalar-mul"))
+			scalar_mul = true;
+		else if (!strcasecmp(argv[i], "montgomery"))
+			montgomery = true;
+		else if (!strcasecmp(argv[i], "threads"))
+			threads = true;
+		else if (!strcasecmp(argv[i], "allocations"))
+			allocations = true;
+		else if (!strcasecmp(argv[i], "sqrt"))
+			sqrt = true;
 		else if (!strcasecmp(argv[i], "weierstrass"))
 			weierstrass = true;
+		else if (!strcasecmp(argv[i], "weierstrass-gf"))
+			weierstrass_gf = true;
+		else if (!strcasecmp(argv[i], "engines"))
+			engines = true;
+		else if (!strcasecmp(argv[i], "strategies"))
+			strategies = true;
 #ifdef HAVE_MSR_SIDH
 		else if (!strcasecmp(argv[i], "msr-sidh"))
 			msr_sidh = true;
@@ -423,15 +1327,43 @@ int main (int argc, char ** argv) {
 			return usage();
 	}
 
-	if (!squaring && !serialization && !weierstrass && !msr_sidh)
+	if (!squaring && !serialization && !key_serialization && !fp751 && !reduction && !batch_invert && !scalar_mul && !montgomery && !threads && !allocations && !sqrt && !weierstrass && !weierstrass_gf && !engines && !strategies && !msr_sidh)
 		return usage();
 
 	if (squaring)
 		test_squaring();
 	if (serialization)
 		test_serialization();
+	if (key_serialization && !test_key_serialization())
+		return 1;
+	if (fp751 && !test_fp751())
+		return 1;
+	if (reduction && !test_reduction())
+		return 1;
+	if (batch_invert && (!test_batch_invert<GF>("GF") || !test_batch_invert<GF751>("GF751")))
+		return 1;
+	if (scalar_mul && (!test_scalar_multiplication<GF>("GF") || !test_scalar_multiplication<GF751>("GF751")))
+		return 1;
+	if (montgomery && (!test_montgomery<GF>("GF") || !test_montgomery<GF751>("GF751")))
+		return 1;
+	if (threads && !test_threads())
+		return 1;
+	if (allocations) {
+		count_allocations<GF>("GF");
+		count_allocations<GF751>("GF751");
+	}
+	if (sqrt) {
+		time_sqrt<GF>("GF");
+		time_sqrt<GF751>("GF751");
+	}
 	if (weierstrass)
-		test_weierstrass();
+		test_weierstrass<GF751>();
+	if (weierstrass_gf)
+		test_weierstrass<GF>();
+	if (engines && !test_engines())
+		return 1;
+	if (strategies && !test_strategies())
+		return 1;
 #ifdef HAVE_MSR_SIDH
 	if (msr_sidh)
 		test_msr_sidh();